@@ -0,0 +1,137 @@
+/******************************************************************************
+* H2023
+* LABORATOIRE 4, Systèmes embarqués et temps réel
+* Interface partagée entre les pilotes du clavier et les programmes utilisateur
+*
+* Ce fichier peut être inclus à la fois par les pilotes (noyau) et par les
+* programmes qui lisent /dev/claviersetr. Il ne doit donc dépendre que des
+* types de <linux/types.h>, des macros de <linux/ioctl.h> et des codes de
+* <linux/input-event-codes.h>.
+*/
+#ifndef SETR_CLAVIER_H
+#define SETR_CLAVIER_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+#include <linux/input-event-codes.h>
+
+// Modes de sortie du fichier spécial (paramètre modeSortie des pilotes)
+#define SETR_MODE_ASCII      0      // Un caractère par appui (comportement par défaut)
+#define SETR_MODE_EVENEMENTS 1      // Une struct setr_evenement par appui ou relâchement
+
+// Types d'événements
+#define SETR_EV_APPUI        1
+#define SETR_EV_RELACHE      2
+
+// Drapeau ajouté au type du dernier événement d'un balayage (une trame).
+// Les événements d'une trame partagent le même horodatage, sont publiés ensemble et
+// arrivent toujours dans le même ordre : les relâchements, puis les appuis, chacun
+// dans l'ordre des touches. Plusieurs appuis dans une trame forment un accord.
+// SETR_EV_TYPE retire ce drapeau pour comparer le type.
+#define SETR_EV_FIN_TRAME    0x80
+#define SETR_EV_TYPE(type)   ((type) & 0x0f)
+
+// Un événement du clavier, tel que lu en mode SETR_MODE_EVENEMENTS.
+// La taille est fixe (16 octets) : un read() retourne toujours un nombre entier
+// d'événements, et len doit permettre d'en contenir au moins un.
+struct setr_evenement {
+    __u64 horodatageNs;     // Temps monotone (ktime_get_ns) du balayage ayant détecté l'événement
+    __u32 sequence;         // Numéro de séquence : un trou indique des événements perdus
+    __u8  code;             // Caractère associé à la touche
+    __u8  ligne;            // Ligne de la touche dans la matrice
+    __u8  colonne;          // Colonne de la touche dans la matrice
+    __u8  type;             // SETR_EV_APPUI ou SETR_EV_RELACHE, avec SETR_EV_FIN_TRAME en fin de trame
+};
+
+// En-tête de la zone projetée par mmap() sur /dev/claviersetr.
+// Les événements commencent à `decalage` octets du début de la zone et forment un
+// anneau de `taille` cases (puissance de 2). Les positions sont des compteurs libres :
+// la case d'une position p est p & (taille - 1), et (ecriture - lecture) donne le
+// nombre d'événements en attente. Le pilote écrit `ecriture` (release) ; le consommateur
+// lit les événements puis avance `lecture` (release). Un seul consommateur à la fois :
+// ne pas mélanger read() et mmap() sur le même périphérique.
+// Si le pilote écrase les anciens événements lorsque l'anneau est plein (politique
+// ecraser), une copie n'est sûre qu'à partir de la position ecritureReservee - taille,
+// relue après la copie ; les positions antérieures ont pu être réécrites entre-temps.
+// En mode diffusion (modeDiffusion=1), `lecture` est tenue par le pilote (plus ancien
+// événement conservé) : la zone ne peut être projetée qu'en lecture seule, et chaque
+// programme garde sa propre position, selon la même règle que la politique ecraser.
+struct setr_anneau_entete {
+    __u32 ecriture;         // Position de la prochaine écriture (écrite par le pilote)
+    __u32 ecritureReservee; // Fin des positions que le pilote peut être en train d'écrire
+    __u32 reserve1[14];     // Place les deux positions sur des lignes de cache distinctes
+    __u32 lecture;          // Position de la prochaine lecture (écrite par le consommateur)
+    __u32 reserve2[15];
+    __u32 taille;           // Nombre de cases de l'anneau
+    __u32 decalage;         // Décalage (en octets) du premier événement depuis le début de la zone
+};
+
+// Commandes ioctl() sur /dev/claviersetr. Le code 0xBE n'est pas attribué dans
+// Documentation/userspace-api/ioctl/ioctl-number.rst ('k' est celui de spidev).
+#define SETR_IOC_MAGIC 0xBE
+
+// Enregistre un eventfd (int, -1 pour le retirer), signalé une fois par balayage ayant
+// ajouté des événements au buffer : de leur nombre, ou de 1 depuis Linux 6.8. Un seul
+// eventfd par clavier ; EBUSY si un autre fichier ouvert en a déjà enregistré un.
+#define SETR_IOC_EVENTFD     _IOW(SETR_IOC_MAGIC, 1, int)
+
+// Nombre d'événements en attente pour ce fichier (__u32). FIONREAD donne plutôt le
+// nombre d'octets qu'un read() retournerait, dans le format de sortie courant.
+#define SETR_IOC_NB_EVENEMENTS _IOR(SETR_IOC_MAGIC, 2, __u32)
+
+// Vide le buffer : les événements en attente pour ce fichier sont abandonnés
+#define SETR_IOC_VIDER       _IO(SETR_IOC_MAGIC, 3)
+
+// Réglages de balayage du clavier ouvert : au chargement, ceux des paramètres du module
+// du même nom, puis propres à chaque clavier. SETR_IOC_CONFIGURER applique au clavier du
+// fichier, et à lui seul, d'un bloc les champs choisis dans `champs`, sans recharger le
+// pilote ni toucher au buffer ou à l'état des touches : aucun balayage ne voit un
+// mélange d'anciens et de nouveaux réglages. Rien n'est
+// appliqué si un champ est invalide (EINVAL) : mode de sortie inconnu, periodeMinUs nulle
+// ou plus longue que pausePollingMs (comparées avec la valeur courante de celle qui
+// n'est pas dans le lot). Le fichier doit être ouvert en écriture (EBADF sinon).
+// SETR_IOC_LIRE_CONFIG retourne tous les réglages courants.
+#define SETR_CFG_PERIODE_MIN    0x01
+#define SETR_CFG_PAUSE_POLLING  0x02
+#define SETR_CFG_DEBOUNCE_APPUI 0x04
+#define SETR_CFG_DEBOUNCE_RELACHE 0x08
+#define SETR_CFG_MODE_SORTIE    0x10
+#define SETR_CFG_TOUS           0x1f
+
+struct setr_config {
+    __u32 champs;               // SETR_CFG_* : champs à appliquer, les autres sont ignorés
+    __u32 periodeMinUs;         // Période de balayage, touche active (us)
+    __u32 pausePollingMs;       // Période de balayage au repos (ms)
+    __u32 debounceAppuiUs;      // Anti-rebond des appuis (us)
+    __u32 debounceRelacheUs;    // Anti-rebond des relâchements (us)
+    __u32 modeSortie;           // SETR_MODE_ASCII ou SETR_MODE_EVENEMENTS
+};
+
+// Code input (KEY_*) d'une valeur de touche, tel que rapporté par la sortie evdev des
+// pilotes (sortieInput) : chiffres et lettres du clavier standard, * et # du pavé
+// numérique. Les autres valeurs donnent KEY_UNKNOWN (à remapper par EVIOCSKEYCODE).
+static inline __u16 setr_code_input(char valeur){
+    static const __u16 lettres[26] = {
+        KEY_A, KEY_B, KEY_C, KEY_D, KEY_E, KEY_F, KEY_G, KEY_H, KEY_I, KEY_J, KEY_K, KEY_L, KEY_M,
+        KEY_N, KEY_O, KEY_P, KEY_Q, KEY_R, KEY_S, KEY_T, KEY_U, KEY_V, KEY_W, KEY_X, KEY_Y, KEY_Z,
+    };
+
+    if (valeur == '0')
+        return KEY_0;
+    if (valeur >= '1' && valeur <= '9')
+        return KEY_1 + (valeur - '1');
+    if (valeur >= 'A' && valeur <= 'Z')
+        return lettres[valeur - 'A'];
+    if (valeur >= 'a' && valeur <= 'z')
+        return lettres[valeur - 'a'];
+    if (valeur == '*')
+        return KEY_KPASTERISK;
+    if (valeur == '#')
+        return KEY_NUMERIC_POUND;
+    return KEY_UNKNOWN;
+}
+
+#define SETR_IOC_LIRE_CONFIG _IOR(SETR_IOC_MAGIC, 4, struct setr_config)
+#define SETR_IOC_CONFIGURER  _IOW(SETR_IOC_MAGIC, 5, struct setr_config)
+
+#endif
@@ -0,0 +1,404 @@
+/******************************************************************************
+* H2023
+* LABORATOIRE 4, Systèmes embarqués et temps réel
+* Coeur commun aux pilotes du clavier : balayage, anti-rebond et anneau d'événements
+*
+* Ce fichier ne dépend ni des GPIO ni de l'horloge du noyau : les broches sont
+* pilotées à travers struct setr_matrice, et les instants sont passés en paramètre.
+* Il se compile donc aussi bien dans un module (avec __KERNEL__) que dans un
+* programme utilisateur ordinaire, pour essayer la logique sur un PC.
+*
+* Un pilote peut définir SETR_TRACE_ENFILAGE(ev, position, perdu) avant d'inclure
+* ce fichier pour tracer chaque ajout dans l'anneau.
+*/
+#ifndef SETR_COEUR_H
+#define SETR_COEUR_H
+
+#include "setr_clavier.h"
+
+#ifdef __KERNEL__
+#include <linux/bitops.h>
+#include <linux/errno.h>
+#include <asm/barrier.h>
+#define setr_charger_acquire(p)         smp_load_acquire(p)
+#define setr_stocker_release(p, v)      smp_store_release(p, v)
+#define setr_barriere_ecriture()        smp_wmb()
+#define setr_barriere_lecture()         smp_rmb()
+#define setr_premier_bit(x)             __ffs64(x)
+#define setr_nb_bits64(x)               hweight64(x)
+#else
+#include <errno.h>
+#define setr_charger_acquire(p)         __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define setr_stocker_release(p, v)      __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define setr_barriere_ecriture()        __atomic_thread_fence(__ATOMIC_RELEASE)
+#define setr_barriere_lecture()         __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define setr_premier_bit(x)             ((unsigned int)__builtin_ctzll(x))
+#define setr_nb_bits64(x)               __builtin_popcountll(x)
+#endif
+
+#ifndef SETR_TRACE_ENFILAGE
+#define SETR_TRACE_ENFILAGE(ev, position, perdu) do { } while (0)
+#endif
+
+// L'état de la matrice tient dans un mot de 64 bits : la touche (ligne, colonne)
+// est le bit ligne * nbColonnes + colonne
+#define SETR_MAX_TOUCHES 64
+#define SETR_BIT(touche) (1ULL << (touche))
+
+
+// ---------------------------------------------------------------------------
+// Accès aux broches
+
+// Le pilote fournit l'écriture groupée des lignes (bit i = ligne i) et la lecture
+// groupée des colonnes (bit j = colonne j) : un balayage complet coûte un appel de
+// chaque par ligne, quelle que soit la taille du clavier (au plus SETR_MAX_TOUCHES touches).
+struct setr_matrice {
+    void (*ecrireLignes)(void *contexte, unsigned long masque);
+    unsigned long (*lireColonnes)(void *contexte);
+    void *contexte;
+    int nbLignes;
+    int nbColonnes;
+};
+
+static inline unsigned long setr_masque_lignes(const struct setr_matrice *m){
+    return (1UL << m->nbLignes) - 1;
+}
+
+static inline __u64 setr_balayer_matrice(const struct setr_matrice *m){
+    // Active les lignes une à une et retourne l'état de toute la matrice,
+    // à raison d'une écriture et d'une lecture groupées par ligne
+    __u64 etat = 0;
+    int ligne;
+
+    for (ligne = 0; ligne < m->nbLignes; ligne++){
+        m->ecrireLignes(m->contexte, 1UL << ligne);
+        etat |= (__u64)m->lireColonnes(m->contexte) << (ligne * m->nbColonnes);
+    }
+    return etat;
+}
+
+static inline __u64 setr_balayer_depuis_repos(const struct setr_matrice *m){
+    // Premier balayage après un réveil par interruption, le clavier ayant été armé au
+    // repos : toutes les lignes sont encore à 1 et aucune touche n'était enfoncée.
+    // Une seule lecture donne les colonnes ayant une touche enfoncée (rien, pour un front
+    // parasite). S'il n'y en a qu'une, aucun rectangle fantôme n'est possible (il en faut
+    // deux) : le numéro de la ligne est lu bit par bit, en pilotant les lignes dont le
+    // numéro a ce bit à 1, puis vérifié en pilotant toutes les autres. Plusieurs touches
+    // dans la colonne, ou deux colonnes ou plus, donnent un balayage complet.
+    // Pour 4 lignes, une touche coûte 7 accès au lieu de 8 ; pour 8 lignes, 9 au lieu de 16.
+    // Avec 2 ou 3 lignes, le balayage complet ne coûte pas plus : il est fait directement.
+    unsigned long colonnes, bitColonne, pilotees;
+    int ligne = 0, bit, l;
+
+    if (m->nbLignes == 2 || m->nbLignes == 3)
+        return setr_balayer_matrice(m);
+    colonnes = m->lireColonnes(m->contexte);
+    if (m->nbLignes == 1 || colonnes == 0)
+        return colonnes;
+    if (colonnes & (colonnes - 1))
+        return setr_balayer_matrice(m);
+
+    bitColonne = colonnes;
+    for (bit = 0; (1 << bit) < m->nbLignes; bit++){
+        pilotees = 0;
+        for (l = 0; l < m->nbLignes; l++)
+            if (l & (1 << bit))
+                pilotees |= 1UL << l;
+        m->ecrireLignes(m->contexte, pilotees);
+        if (m->lireColonnes(m->contexte) & bitColonne)
+            ligne |= 1 << bit;
+    }
+    // Deux touches de la colonne donnent le OU de leurs numéros : l'une des deux au
+    // moins est parmi les autres lignes
+    if (ligne >= m->nbLignes)
+        return setr_balayer_matrice(m);
+    m->ecrireLignes(m->contexte, setr_masque_lignes(m) & ~(1UL << ligne));
+    if (m->lireColonnes(m->contexte) & bitColonne)
+        return setr_balayer_matrice(m);
+    return SETR_BIT(ligne * m->nbColonnes + setr_premier_bit(colonnes));
+}
+
+// ---------------------------------------------------------------------------
+// Anti-rebond
+
+// Chaque touche a un état stable (etatStable, le dernier publié) et un état brut
+// (etatBrut, le dernier lu). Chaque fois que le niveau brut d'une touche change,
+// son chronomètre repart ; l'état stable ne suit l'état brut qu'une fois celui-ci
+// resté inchangé pendant le délai d'appui ou de relâchement.
+// Les touches d'un rectangle fantôme (fantomes) gardent leur état stable.
+// instantChangement a une case par touche : allouer SETR_TAILLE_ANTIREBOND(nbTouches) octets.
+struct setr_antirebond {
+    __u64 etatBrut;
+    __u64 etatStable;
+    __u64 fantomes;
+    __u64 instantChangement[];
+};
+#define SETR_TAILLE_ANTIREBOND(nbTouches) (sizeof(struct setr_antirebond) + (nbTouches) * sizeof(__u64))
+
+static inline __u64 setr_touches_fantomes(const struct setr_matrice *m, __u64 etat){
+    // Sans diodes, trois touches enfoncées aux coins d'un rectangle font lire la quatrième
+    // comme enfoncée. Dès que deux lignes ont au moins deux colonnes en commun, on ne peut
+    // donc plus savoir lesquelles des quatre touches sont réelles : retourne les bits de
+    // tous ces rectangles. Deux touches quelconques ne forment jamais de rectangle.
+    __u64 masqueLigne = (1ULL << m->nbColonnes) - 1;
+    __u64 communes, fantomes = 0;
+    int l1, l2;
+
+    for (l1 = 0; l1 < m->nbLignes; l1++){
+        for (l2 = l1 + 1; l2 < m->nbLignes; l2++){
+            communes = (etat >> (l1 * m->nbColonnes)) & (etat >> (l2 * m->nbColonnes)) & masqueLigne;
+            if (communes & (communes - 1))
+                fantomes |= (communes << (l1 * m->nbColonnes)) | (communes << (l2 * m->nbColonnes));
+        }
+    }
+    return fantomes;
+}
+
+static inline __u64 setr_filtrer_rebonds(struct setr_antirebond *f, const struct setr_matrice *m,
+                                         __u64 brut, __u64 maintenant,
+                                         __u64 delaiAppuiNs, __u64 delaiRelacheNs){
+    // Retourne le nouvel état stable, à passer à setr_publier_changements.
+    // brut doit être un instantané de toute la matrice : les rectangles fantômes
+    // ne peuvent être détectés qu'en voyant toutes les lignes à la fois.
+    __u64 bascules = brut ^ f->etatBrut;
+    __u64 enAttente, stable = f->etatStable;
+    unsigned int touche;
+
+    while (bascules){
+        touche = setr_premier_bit(bascules);
+        bascules &= bascules - 1;
+        f->instantChangement[touche] = maintenant;
+    }
+    f->etatBrut = brut;
+    f->fantomes = setr_touches_fantomes(m, brut);
+
+    // Seules les touches dont l'état brut diffère de l'état stable peuvent changer,
+    // sauf celles d'un rectangle fantôme, figées jusqu'à ce qu'il se défasse
+    enAttente = (brut ^ stable) & ~f->fantomes;
+    while (enAttente){
+        touche = setr_premier_bit(enAttente);
+        enAttente &= enAttente - 1;
+        if (maintenant - f->instantChangement[touche] >= ((brut & SETR_BIT(touche)) ? delaiAppuiNs : delaiRelacheNs))
+            stable ^= SETR_BIT(touche);
+    }
+    return stable;
+}
+
+// Touches dont l'état brut n'est pas encore accepté (en cours de filtrage)
+static inline __u64 setr_touches_en_attente(const struct setr_antirebond *f){
+    return (f->etatBrut ^ f->etatStable) & ~f->fantomes;
+}
+
+
+// ---------------------------------------------------------------------------
+// Anneau d'événements (un producteur, un consommateur)
+
+// La zone partagée contient l'en-tête puis les événements (voir setr_anneau_entete).
+// Les positions sont des compteurs libres : la case d'une position p est p & (taille - 1).
+// Le producteur garde sa propre copie de la position d'écriture : celle de l'en-tête
+// n'est qu'une publication pour le consommateur, qui peut écrire n'importe quoi dans la zone.
+// Les événements sont écrits un à un mais publiés par trame (un balayage) : le
+// consommateur voit tous les événements d'un accord, ou aucun.
+//
+// Lorsque l'anneau est plein, la politique choisit ce qui est perdu :
+//  - SETR_DEBORDEMENT_REJETER : la nouvelle trame, en entier ;
+//  - SETR_DEBORDEMENT_ECRASER : les événements les plus anciens non lus. Le producteur
+//    annonce (reservee) les positions qu'il va écrire avant d'y toucher : après sa copie,
+//    le consommateur vérifie avec setr_anneau_premier_valide qu'elles n'ont pas été réécrites ;
+//  - SETR_DEBORDEMENT_BLOQUER : le pilote attend que le consommateur libère de la place
+//    avant de publier (voir setr_nb_changements) ; sinon, comme REJETER.
+#define SETR_DEBORDEMENT_REJETER 0
+#define SETR_DEBORDEMENT_ECRASER 1
+#define SETR_DEBORDEMENT_BLOQUER 2
+
+struct setr_anneau {
+    struct setr_anneau_entete *entete;
+    struct setr_evenement *evenements;
+    __u32 taille;                   // Puissance de 2
+    __u32 ecriture;                 // Position de la prochaine écriture (producteur seulement)
+    __u32 publie;                   // Fin des événements visibles (copie privée, seule fiable)
+    __u32 reservee;                 // Fin des positions que le producteur peut être en train d'écrire
+    __u32 sequence;                 // Numéro de séquence du prochain événement produit
+    int politique;                  // SETR_DEBORDEMENT_*
+
+    // Compteurs, écrits par le producteur seulement
+    __u64 enfiles;                  // Événements ajoutés à l'anneau
+    __u64 perdus;                   // Événements rejetés, ou écrasés avant d'être lus
+    __u32 occupationMax;            // Plus grand nombre d'événements en attente observé
+};
+
+static inline void setr_anneau_init(struct setr_anneau *a, void *zone, __u32 taille, __u32 decalage, int politique){
+    // zone doit être mise à zéro et contenir decalage + taille événements
+    a->entete = (struct setr_anneau_entete *)zone;
+    a->evenements = (struct setr_evenement *)((char *)zone + decalage);
+    a->taille = taille;
+    a->ecriture = 0;
+    a->publie = 0;
+    a->reservee = 0;
+    a->sequence = 0;
+    a->politique = politique;
+    a->enfiles = 0;
+    a->perdus = 0;
+    a->occupationMax = 0;
+    a->entete->taille = taille;
+    a->entete->decalage = decalage;
+}
+
+static inline struct setr_evenement *setr_anneau_case(const struct setr_anneau *a, __u32 position){
+    return &a->evenements[position & (a->taille - 1)];
+}
+
+static inline __u32 setr_anneau_position_lecture(const struct setr_anneau *a, __u32 ecriture){
+    // La position de lecture est dans la zone partagée : on la ramène dans l'intervalle valide
+    __u32 lecture = setr_charger_acquire(&a->entete->lecture);
+
+    if (ecriture - lecture > a->taille)
+        lecture = ecriture - a->taille;
+    return lecture;
+}
+
+// Position d'écriture vue par le consommateur. Acquire : les événements sont visibles avant.
+static inline __u32 setr_anneau_fin(const struct setr_anneau *a){
+    return setr_charger_acquire(&a->publie);
+}
+
+static inline __u32 setr_anneau_disponibles(const struct setr_anneau *a){
+    __u32 ecriture = setr_anneau_fin(a);
+    return ecriture - setr_anneau_position_lecture(a, ecriture);
+}
+
+static inline __u32 setr_anneau_libres(const struct setr_anneau *a){
+    // Côté producteur : nombre de cases pouvant être écrites sans écraser de données non lues.
+    // Acquire : on ne réutilise une case qu'après que le lecteur ait fini de la copier
+    __u32 occupees = a->ecriture - setr_charger_acquire(&a->entete->lecture);
+
+    // Une position de lecture invalide (écrite par l'utilisateur) compte comme un anneau plein
+    return occupees >= a->taille ? 0 : a->taille - occupees;
+}
+
+static inline void setr_anneau_enfiler(struct setr_anneau *a, struct setr_evenement *ev, int perdu){
+    // Côté producteur : ne dort et ne bloque jamais. L'appelant a vérifié la place avec
+    // setr_anneau_libres (ou annoncé l'écrasement avec setr_anneau_reserver) ; s'il n'y
+    // en a pas (perdu), l'événement est abandonné. Le numéro de séquence de ev est rempli ici,
+    // et avance même si l'événement est perdu, pour que le trou soit visible.
+    // L'événement n'est visible qu'après setr_anneau_publier.
+    ev->sequence = a->sequence++;
+    SETR_TRACE_ENFILAGE(ev, a->ecriture, perdu);
+    if (!perdu)
+        *setr_anneau_case(a, a->ecriture++) = *ev;
+}
+
+static inline void setr_anneau_reserver(struct setr_anneau *a, __u32 n){
+    // Annonce que les n prochaines positions vont être écrites. La barrière garantit
+    // que l'annonce est visible avant la moindre écriture dans les cases. reservee est
+    // relue sans verrou par le lecteur (setr_anneau_premier_valide) : stockage atomique.
+    __u32 reservee = a->ecriture + n;
+
+    setr_stocker_release(&a->reservee, reservee);
+    setr_stocker_release(&a->entete->ecritureReservee, reservee);
+    setr_barriere_ecriture();
+}
+
+static inline void setr_anneau_oublier(struct setr_anneau *a, __u32 n){
+    // Côté producteur, quand personne ne tient la position de lecture partagée (plusieurs
+    // lecteurs ayant chacun la leur) : l'anneau ne garde que les derniers événements et
+    // abandonne les plus anciens pour faire place à n nouveaux, sans les compter perdus.
+    // Chaque lecteur détecte lui-même qu'il a été dépassé.
+    if (n > setr_anneau_libres(a) && n <= a->taille)
+        setr_stocker_release(&a->entete->lecture, a->ecriture + n - a->taille);
+}
+
+static inline void setr_anneau_publier(struct setr_anneau *a){
+    // Release : les événements enfilés sont visibles avant la nouvelle position d'écriture,
+    // autant pour la copie privée que pour un consommateur ayant projeté la zone
+    setr_stocker_release(&a->publie, a->ecriture);
+    setr_stocker_release(&a->entete->ecriture, a->ecriture);
+}
+
+static inline __u32 setr_anneau_segment(const struct setr_anneau *a, __u32 lecture, __u32 n){
+    // Les n événements à partir de lecture peuvent être en deux morceaux : retourne le
+    // nombre contenu dans le premier (jusqu'à la fin du tableau), le reste part du début
+    __u32 avantFin = a->taille - (lecture & (a->taille - 1));
+    return n < avantFin ? n : avantFin;
+}
+
+// Côté consommateur. Release : le producteur ne réutilise les cases qu'une fois copiées.
+static inline void setr_anneau_liberer(struct setr_anneau *a, __u32 lecture){
+    setr_stocker_release(&a->entete->lecture, lecture);
+}
+
+static inline __u32 setr_anneau_premier_valide(const struct setr_anneau *a, __u32 lecture){
+    // Côté consommateur, après avoir copié des événements à partir de lecture : retourne
+    // la première position dont la copie est sûre. Avec SETR_DEBORDEMENT_ECRASER, les
+    // positions antérieures ont pu être réécrites pendant la copie et doivent être jetées.
+    __u32 reservee;
+
+    setr_barriere_lecture();
+    reservee = setr_charger_acquire(&a->reservee);
+    return reservee - lecture > a->taille ? reservee - a->taille : lecture;
+}
+
+
+// ---------------------------------------------------------------------------
+// Publication
+
+static inline unsigned int setr_nb_changements(const struct setr_antirebond *f, __u64 etat, int avecRelachements){
+    // Nombre d'événements que setr_publier_changements produirait pour cet état
+    __u64 changements = etat ^ f->etatStable;
+
+    return setr_nb_bits64(changements & etat) + (avecRelachements ? setr_nb_bits64(changements & ~etat) : 0);
+}
+
+static inline int setr_publier_changements(struct setr_antirebond *f, struct setr_anneau *a,
+                                           const struct setr_matrice *m, const char *codes,
+                                           __u64 etat, __u64 horodatage, int avecRelachements){
+    // Compare l'état filtré à l'état stable précédent sur toute la matrice à la fois :
+    // seules les touches ayant changé produisent un appui ou un relâchement.
+    // Les événements d'un balayage forment une trame, toujours dans le même ordre :
+    // les relâchements puis les appuis, chacun dans l'ordre des touches. Le dernier porte
+    // SETR_EV_FIN_TRAME, et la trame est publiée d'un bloc. Si elle ne tient pas dans
+    // l'anneau, elle est perdue en entier plutôt que de livrer un accord incomplet, sauf
+    // avec SETR_DEBORDEMENT_ECRASER où les plus anciens événements non lus lui font place.
+    // codes donne le caractère de chaque touche, dans l'ordre des bits de l'état.
+    // Sans avecRelachements (mode ASCII), seuls les appuis sont ajoutés.
+    // Retourne le nombre d'événements ajoutés à l'anneau.
+    __u64 changements = etat ^ f->etatStable;
+    __u64 lots[2] = { avecRelachements ? changements & ~etat : 0, changements & etat };
+    const __u8 types[2] = { SETR_EV_RELACHE, SETR_EV_APPUI };
+    struct setr_evenement ev;
+    unsigned int touche, restants = setr_nb_changements(f, etat, avecRelachements);
+    __u32 libres = setr_anneau_libres(a), occupation;
+    int ecraser = a->politique == SETR_DEBORDEMENT_ECRASER;
+    int i, perdue = restants > (ecraser ? a->taille : libres);
+    int nouveaux = perdue ? 0 : restants;
+
+    f->etatStable = etat;
+    if (perdue)
+        a->perdus += restants;
+    else if (restants > libres)
+        a->perdus += restants - libres;     // Écrasés avant d'avoir été lus
+    if (nouveaux > 0)
+        setr_anneau_reserver(a, nouveaux);
+    ev.horodatageNs = horodatage;       // Tous les événements d'un balayage partagent le même temps
+    for (i = 0; i < 2; i++){
+        while (lots[i]){
+            touche = setr_premier_bit(lots[i]);
+            lots[i] &= lots[i] - 1;
+            ev.type = types[i] | (--restants == 0 ? SETR_EV_FIN_TRAME : 0);
+            ev.code = codes[touche];
+            ev.ligne = touche / m->nbColonnes;
+            ev.colonne = touche % m->nbColonnes;
+            setr_anneau_enfiler(a, &ev, perdue);
+        }
+    }
+    if (nouveaux > 0){
+        setr_anneau_publier(a);
+        a->enfiles += nouveaux;
+        occupation = a->taille - setr_anneau_libres(a);
+        if (occupation > a->occupationMax)
+            a->occupationMax = occupation;
+    }
+    return nouveaux;
+}
+
+#endif
@@ -0,0 +1,2037 @@
+/******************************************************************************
+* H2023
+* LABORATOIRE 4, Systèmes embarqués et temps réel
+* Pilote du clavier, par polling, par interruptions ou hybride
+* Marc-André Gardner, mars 2019
+*
+* Ce fichier contient le pilote du clavier. Chaque clavier a un thread noyau
+* d'acquisition, qui peut fonctionner en mode "polling" (il vérifie en permanence
+* si une touche a été enfoncée), en mode "irq" (il ne balaye le clavier qu'après
+* une interruption sur une broche de lecture, puis lentement tant qu'une touche reste
+* enfoncée) ou en mode "hybride" (interruptions au repos, polling rapide tant qu'une
+* touche est enfoncée). Le mode se choisit au chargement (modeAcquisition) et se change
+* à chaud dans /sys/class/setr/<clavier>/mode.
+*
+* Prenez le temps de lire attentivement les notes de cours et les commentaires
+* contenus dans ce fichier, ils contiennent des informations cruciales.
+*
+* Inspiré de http://derekmolloy.ie/writing-a-linux-kernel-module-part-1-introduction/
+*/
+
+// Inclusion des en-têtes nécessaires
+// Vous pouvez en ajouter, mais n'oubliez pas que vous n'avez PAS
+// accès la libc! Vous ne pouvez vous servir que des fonctions fournies
+// par le noyau Linux.
+#include <linux/init.h>             // Macros spécifiques des fonctions d'un module
+#include <linux/module.h>           // En-tête général des modules noyau
+#include <linux/device.h>           // Pour créer un pilote
+#include <linux/kernel.h>           // Différentes définitions de types liés au noyau
+#include <linux/gpio.h>             // Pour accéder aux GPIO du Raspberry Pi
+#include <linux/gpio/consumer.h>    // Accès groupé aux GPIO par descripteurs
+#include <linux/version.h>          // L'API groupée a changé de signature en 5.0
+#include <linux/fs.h>               // Pour accéder au système de fichier et créer un fichier spécial dans /dev
+#include <linux/cdev.h>             // Un périphérique (numéro mineur) par clavier
+#include <linux/uaccess.h>          // Permet d'accéder à copy_to_user et copy_from_user
+#include <linux/uio.h>              // Lectures vectorielles (read_iter, readv) avec copy_to_iter
+#include <linux/kthread.h>          // Utilisation des threads noyau
+#include <linux/sched.h>            // Ordonnancement temps réel du thread d'acquisition
+#include <linux/sched/types.h>      // struct sched_param
+#include <linux/delay.h>            // Fonctions d'attente, en particulier msleep
+#include <linux/hrtimer.h>          // Attentes haute résolution entre deux balayages
+#include <linux/string.h>           // Différentes fonctions de manipulation de string, plus memset et memcpy
+#include <linux/mutex.h>            // Mutex et synchronisation
+#include <linux/interrupt.h>        // Définit les symboles pour les interruptions
+#include <linux/irq.h>              // Masquage immédiat des IRQ (IRQ_DISABLE_UNLAZY)
+#include <linux/atomic.h>           // Synchronisation par valeur atomique
+#include <linux/percpu.h>           // Compteurs d'activité par processeur
+#include <linux/wait.h>             // Files d'attente pour les lectures bloquantes
+#include <linux/poll.h>             // Support de poll/select/epoll
+#include <linux/ktime.h>            // Horodatage monotone des événements
+#include <linux/math64.h>           // Divisions 64 bits utilisables sur une cible 32 bits
+#include <linux/mm.h>               // Projection mémoire (mmap) de l'anneau
+#include <linux/vmalloc.h>          // Allocation de la zone partagée avec l'espace utilisateur
+#include <linux/slab.h>             // État du balayage, dimensionné au chargement selon la géométrie
+#include <linux/input.h>            // Sortie optionnelle par le sous-système input (evdev)
+#include <linux/eventfd.h>          // Notification des boucles d'événements par eventfd
+#include <linux/spinlock.h>
+#include <linux/seqlock.h>          // Réglages de balayage modifiés d'un bloc par ioctl
+#include <linux/log2.h>             // La taille du buffer circulaire doit être une puissance de 2
+
+#include <linux/debugfs.h>          // Histogrammes de latence dans /sys/kernel/debug
+#include <linux/seq_file.h>
+
+#include "setr_clavier.h"           // Format des événements partagé avec les programmes utilisateur
+
+#define CREATE_TRACE_POINTS
+#include "setr_trace.h"             // Points de trace des chemins critiques (remplacent les printk)
+
+#define SETR_TRACE_ENFILAGE(ev, position, perdu) trace_setr_enfilage(ev, position, perdu)
+#include "setr_coeur.h"             // Balayage, anti-rebond et anneau, indépendants du noyau
+
+
+// Le nom de notre périphérique et le nom de sa classe
+// Le premier clavier est /dev/claviersetr, les suivants /dev/claviersetr1, 2, ...
+#define DEV_NAME "claviersetr"
+#define CLS_NAME "setr"
+
+// Bornes du nombre d'événements du buffer circulaire (paramètre tailleBuffer)
+#define MIN_TAILLE_BUFFER 16
+#define MAX_TAILLE_BUFFER 65536
+
+// Géométrie maximale d'un clavier : l'état de toutes ses touches doit tenir dans 64 bits
+#define MAX_LIGNES 8
+#define MAX_COLONNES 8
+// Nombre maximal de claviers gérés par le pilote
+#define MAX_CLAVIERS 4
+
+// La zone partagée par mmap() : une page d'en-tête, suivie des événements
+#define TAILLE_ZONE(nbEvenements) PAGE_ALIGN(PAGE_SIZE + (nbEvenements) * sizeof(struct setr_evenement))
+
+
+// Modes d'acquisition, voir acquisitionClavier
+#define SETR_ACQ_POLLING 0
+#define SETR_ACQ_IRQ 1
+#define SETR_ACQ_HYBRIDE 2
+
+static const char *const nomsModes[] = {"polling", "irq", "hybride"};
+
+// Politiques de débordement du buffer circulaire, dans l'ordre des SETR_DEBORDEMENT_*
+static const char *const nomsPolitiques[] = {"rejeter", "ecraser", "bloquer"};
+
+// Déclaration des fonctions pour gérer notre fichier
+// Nous définissons open(), close(), read() (et readv(), par read_iter), poll(), mmap(),
+// ioctl() et fcntl(F_SETFL, O_ASYNC) (par fasync)
+static int      dev_open(struct inode *, struct file *);
+static int      dev_release(struct inode *, struct file *);
+static ssize_t  dev_read_iter(struct kiocb *, struct iov_iter *);
+static __poll_t dev_poll(struct file *, poll_table *);
+static int      dev_mmap(struct file *, struct vm_area_struct *);
+static long     dev_ioctl(struct file *, unsigned int, unsigned long);
+static int      dev_fasync(int, struct file *, int);
+
+static struct file_operations fops =
+{
+   .owner = THIS_MODULE,
+   .open = dev_open,
+   .read_iter = dev_read_iter,
+   .poll = dev_poll,
+   .mmap = dev_mmap,
+   .unlocked_ioctl = dev_ioctl,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 5, 0)
+   .compat_ioctl = compat_ptr_ioctl,
+#endif
+   .fasync = dev_fasync,
+   .release = dev_release,
+};
+
+// Histogrammes de latence (log2, en ns), exposés dans /sys/kernel/debug/setr_clavier/<clavier>/latences.
+// Le déclenchement d'un balayage est l'échéance du timer ou l'interruption qui l'a provoqué.
+// La case i compte les mesures dans [2^(i-1), 2^i[ ns ; la dernière reçoit tout ce qui dépasse.
+#define NB_CASES_HISTO 32
+struct histogramme {
+    const char *nom;
+    atomic_t cases[NB_CASES_HISTO];
+};
+
+// Une IRQ par colonne. Chaque IRQ reçoit sa colonne en dev_id.
+struct colonneIrq {
+    struct clavierSetr *clavier;            // Le clavier auquel appartient la colonne
+    int colonne;
+    unsigned int irq;                       // Numéro d'interruption de la broche de lecture
+};
+
+// Gigue des réveils sur échéance : écart entre l'échéance prévue et le début effectif du
+// balayage. Les cases (1 us chacune) servent à estimer le 99e centile ; la dernière reçoit
+// tout ce qui dépasse. Hors polling rapide, le noyau peut légitimement réveiller le thread
+// jusqu'à periode/16 après l'échéance : seul le retard au-delà de cette marge est compté.
+// Seul le thread d'acquisition écrit.
+#define NB_CASES_GIGUE 1000
+struct gigue {
+    u64 min;
+    u64 max;
+    u64 nb;
+    u32 cases[NB_CASES_GIGUE];
+};
+
+// Un fichier ouvert sur un clavier (filep->private_data). En mode diffusion, chaque fichier
+// a sa propre position de lecture et son propre mutex ; sinon, tous partagent la position
+// de l'anneau et le mutex du clavier.
+struct lecteurSetr {
+    struct clavierSetr *clavier;
+    struct mutex sync;                      // Sérialise les lectures de ce fichier (mode diffusion)
+    u32 lecture;                            // Position de lecture (mode diffusion seulement)
+    bool depasse;                           // Événements écrasés avant d'être lus : à signaler par -EOVERFLOW
+};
+
+// Compteurs d'activité d'un clavier, exposés dans /sys/class/setr/<clavier>/. Il y en a une
+// copie par processeur : un incrément (this_cpu_inc) ne touche que celle du processeur
+// courant, sans verrou ni instruction atomique partagée, et sysfs additionne les copies.
+struct compteursSetr {
+    unsigned long balayages;                // Balayages effectués, tous modes confondus
+    unsigned long balayagesIrq;             // Balayages déclenchés par une interruption
+    unsigned long irqInutiles;              // Balayages déclenchés par interruption sans aucun changement
+    unsigned long frontsRecus;              // Fronts reçus par le gestionnaire
+    unsigned long frontsFusionnes;          // Fronts reçus alors qu'un balayage était déjà demandé
+    unsigned long frontsMasques;            // Colonnes ayant changé pendant que leurs IRQ étaient masquées
+    unsigned long limitationsDebit;         // Réarmements retardés par maxBalayagesIrq (pas des fronts)
+    unsigned long evenementsLus;            // Événements retirés du buffer par read()
+    unsigned long evenementsEnfiles;        // Événements ajoutés au buffer
+    unsigned long evenementsPerdus;         // Événements rejetés, ou écrasés avant d'être lus
+    unsigned long occupationMax;            // Plus grande occupation du buffer vue sur ce processeur (max, pas somme)
+};
+// Un lecteur ayant projeté l'anneau (setr_lecteur.h) retire ses événements sans passer par
+// le pilote : evenementsLus ne les compte pas. evenementsEnfiles moins occupation compte
+// tout ce qui a quitté l'anneau, par read() ou par mmap (et, en politique ecraser, les
+// événements écrasés).
+
+// Réglages d'un clavier, lus par son thread d'acquisition d'un bloc au début de chaque
+// balayage. Ils partent des paramètres du module du même nom ; SETR_IOC_CONFIGURER les
+// modifie ensuite sous verrouReglages, pour ce clavier seulement : un balayage voit tous
+// les anciens réglages ou tous les nouveaux.
+struct reglages {
+    unsigned int periodeMinUs;
+    unsigned int pausePollingMs;
+    unsigned int debounceAppuiUs;
+    unsigned int debounceRelacheUs;
+    unsigned int modeSortie;
+};
+
+#define NB_SECONDES_DEBIT 4
+
+// Tout l'état d'un clavier. Chaque clavier a son propre fichier spécial, son buffer,
+// son thread d'acquisition et ses statistiques : deux claviers ne partagent aucun verrou
+// et sont balayés en parallèle.
+struct clavierSetr {
+    int indice;                             // Numéro du clavier (et numéro mineur)
+    struct cdev cdev;
+    struct device *device;
+    struct dentry *repertoireDebug;
+
+    // Géométrie et broches (les tableaux de GPIO pointent dans les paramètres du module)
+    int nbLignes;
+    int nbColonnes;
+    const int *gpiosEcrire;
+    const int *gpiosLire;
+    const char *touches;                    // Caractère de chaque touche, ligne par ligne
+    seqlock_t verrouReglages;               // Protège reglages (voir lireReglages)
+    struct reglages reglages;
+    // Les descripteurs correspondants, pour piloter ou lire toutes les broches d'un seul appel
+    struct gpio_desc **descLignes;
+    struct gpio_desc **descColonnes;
+    struct setr_matrice matrice;            // Les broches, vues par le coeur commun
+
+    // Permet de se souvenir du dernier état du clavier (antirebond->etatStable),
+    // pour ne pas répéter une touche qui était déjà enfoncée, ainsi que de l'état brut
+    // et de l'instant du dernier changement de chaque touche pour l'anti-rebond.
+    // Un bit par touche : le bit (ligne * nbColonnes + colonne) vaut 1 si elle est enfoncée.
+    struct setr_antirebond *antirebond;
+
+    // Le buffer circulaire vit dans une zone allouée au chargement et projetable par mmap() :
+    // l'en-tête contient les positions, suivi du tableau des événements (voir setr_coeur.h).
+    // Un seul producteur (le thread d'acquisition) écrit les positions d'écriture, un seul consommateur
+    // (read() ou un programme ayant projeté la zone) écrit la position de lecture.
+    void *zonePartagee;                     // Zone entière, telle que projetée par mmap()
+    size_t tailleZone;
+    struct setr_anneau anneau;              // Buffer circulaire contenant les événements du clavier
+
+    wait_queue_head_t fileLecteurs;         // Lecteurs en attente de nouveaux événements
+    struct fasync_struct *fileAsync;        // Fichiers demandant SIGIO (O_ASYNC)
+    // eventfd signalé à chaque trame (SETR_IOC_EVENTFD) et le fichier qui l'a enregistré,
+    // protégés par verrouEventfd (jamais pris en interruption)
+    struct eventfd_ctx *eventfd;
+    struct lecteurSetr *proprioEventfd;
+    spinlock_t verrouEventfd;
+    wait_queue_head_t fileProducteur;       // Balayage en attente de place (politique bloquer)
+    struct mutex sync;                      // Mutex sérialisant les lecteurs (le balayage n'y touche jamais)
+    struct task_struct *task;               // Réfère au thread d'acquisition (NULL sans lecteur)
+    struct mutex verrouDemarrage;           // Protège task, nbOuvertures et nbFichiers
+    int nbOuvertures;                       // Utilisateurs : fichiers ouverts et clients evdev
+    int nbFichiers;                         // Fichiers ouverts sur le fichier spécial seulement
+
+    // Sortie par le sous-système input (NULL sans sortieInput). codesInput donne le code
+    // de chaque touche, dans l'ordre des bits de l'état ; les clients peuvent le modifier.
+    struct input_dev *input;
+    unsigned short codesInput[MAX_LIGNES * MAX_COLONNES];
+    char physInput[32];
+
+    int mode;                               // SETR_ACQ_*, modifiable à chaud par sysfs
+    atomic_t irqArmees;                     // 1 tant que le thread attend une interruption (voir setr_irq_handler)
+    atomic_t colonnesSignalees;             // Colonnes ayant reçu une interruption depuis le dernier balayage
+    u64 instantIrq;                         // Instant (ns) de l'interruption ayant réveillé le thread
+    bool irqMasquees;                       // IRQ des colonnes masquées (thread d'acquisition seulement)
+    u64 dernierBalayageIrq;                 // Instant du dernier balayage déclenché par interruption
+    struct colonneIrq *colonnesIrq;
+
+    struct compteursSetr __percpu *compteurs;
+    u64 dureeMaxBalayageNs;                 // Écrit par le seul thread d'acquisition
+    // Balayages par seconde d'horloge, sur les NB_SECONDES_DEBIT dernières secondes :
+    // la case s % NB_SECONDES_DEBIT compte la seconde s, secondeDebit est la plus récente.
+    // Écrites par le seul thread d'acquisition (voir compterBalayage).
+    u32 balayagesSeconde[NB_SECONDES_DEBIT];
+    u32 secondeDebit;
+
+    struct histogramme histoDeclenchement;
+    struct histogramme histoBalayage;
+    struct histogramme histoLecture;
+    struct gigue gigue;                     // Exposée dans /sys/class/setr/<clavier>/gigue*
+};
+
+// Variables globales et statiques utilisées dans le driver
+static dev_t premierNumero;                 // Numéro (majeur, mineur) donné par le noyau au premier clavier
+static struct class*  setrClasse  = NULL;   // Contiendra les informations sur la classe de notre pilote
+static struct dentry *repertoireDebug = NULL;
+static struct clavierSetr *claviers[MAX_CLAVIERS];
+
+// Par défaut, un seul clavier : 4 GPIO en écriture (lignes) et 3 en lecture (colonnes),
+// jusqu'à 8 de chaque. Le nombre de GPIO donnés détermine la géométrie, par exemple pour un 4x4 :
+//     insmod setr_driver.ko gpiosEcrire=5,6,13,19 gpiosLire=12,16,20,21 touches=123A456B789C*0#D
+// Pour plusieurs claviers, leurs GPIO sont donnés à la suite, et lignes/colonnes indiquent
+// combien en prend chacun. Une seule valeur de touches sert à tous les claviers :
+//     insmod setr_driver.ko gpiosEcrire=5,6,13,19,17,27,22,23 gpiosLire=12,16,20,24,25,26 lignes=4,4 colonnes=3,3
+// (sur PC, les numéros sont ceux d'une puce gpio-sim, voir tests/gpiosim/gpiosim.sh)
+static int  gpiosEcrire[MAX_CLAVIERS * MAX_LIGNES] = {5, 6, 13, 19};   // Correspond aux pins 29, 31, 33 et 35
+static int  gpiosLire[MAX_CLAVIERS * MAX_COLONNES] = {12, 16, 20};     // Correspond aux pins 32, 36 et 38
+static int  nbGpiosEcrire = 4;
+static int  nbGpiosLire = 3;
+module_param_array(gpiosEcrire, int, &nbGpiosEcrire, S_IRUGO);
+MODULE_PARM_DESC(gpiosEcrire, " Numeros des GPIO pilotant les lignes, clavier par clavier (5,6,13,19 par defaut)");
+module_param_array(gpiosLire, int, &nbGpiosLire, S_IRUGO);
+MODULE_PARM_DESC(gpiosLire, " Numeros des GPIO lisant les colonnes, clavier par clavier (12,16,20 par defaut)");
+
+static int  lignes[MAX_CLAVIERS];
+static int  colonnes[MAX_CLAVIERS];
+static int  nbClaviers = 0;
+static int  nbClaviersColonnes = 0;
+module_param_array(lignes, int, &nbClaviers, S_IRUGO);
+MODULE_PARM_DESC(lignes, " Nombre de lignes de chaque clavier, 8 au plus (toutes les GPIO de lignes par defaut)");
+module_param_array(colonnes, int, &nbClaviersColonnes, S_IRUGO);
+MODULE_PARM_DESC(colonnes, " Nombre de colonnes de chaque clavier, 8 au plus (toutes les GPIO de colonnes par defaut)");
+
+// Les valeurs de chaque clavier, ligne par ligne : nbLignes * nbColonnes caractères.
+// S'il y a moins de valeurs que de claviers, la dernière sert aux claviers suivants.
+static char *touches[MAX_CLAVIERS] = {"123456789*0#"};
+static int  nbTouches = 1;
+module_param_array(touches, charp, &nbTouches, S_IRUGO);
+MODULE_PARM_DESC(touches, " Caracteres des touches de chaque clavier, ligne par ligne (123456789*0# par defaut)");
+
+// Les noms des différents GPIO
+static char* gpiosEcrireNoms[MAX_LIGNES] = {"OUT1", "OUT2", "OUT3", "OUT4", "OUT5", "OUT6", "OUT7", "OUT8"};
+static char* gpiosLireNoms[MAX_COLONNES] = {"IN1", "IN2", "IN3", "IN4", "IN5", "IN6", "IN7", "IN8"};
+
+
+// Nombre d'événements du buffer circulaire de chaque clavier, puissance de 2 entre 16 et 65536 :
+// les positions sont masquées plutôt que bouclées.
+// Lorsqu'il est plein, politiqueDebordement choisit ce qui est perdu : la nouvelle trame
+// (rejeter, défaut), les plus anciens événements non lus (ecraser), ou rien, le balayage
+// attendant alors que le lecteur libère de la place (bloquer). Les pertes restent visibles
+// dans les numéros de séquence et dans /sys/class/setr/<clavier>/evenementsPerdus.
+static unsigned int tailleBuffer = 256;
+module_param(tailleBuffer, uint, S_IRUGO);
+MODULE_PARM_DESC(tailleBuffer, " Nombre d'evenements du buffer circulaire, puissance de 2 (256 par defaut)");
+
+static char *politiqueDebordement = "rejeter";
+module_param(politiqueDebordement, charp, S_IRUGO);
+MODULE_PARM_DESC(politiqueDebordement, " Buffer plein : rejeter (nouvelle trame, defaut), ecraser (plus anciens) ou bloquer (le balayage attend)");
+
+// En mode diffusion, chaque fichier ouvert reçoit tous les événements (une application et un
+// journal d'audit, par exemple) au lieu de se les partager : l'anneau n'est écrit qu'une fois,
+// chaque lecteur y garde sa propre position, et le balayage ne dépend pas du nombre de
+// lecteurs. L'anneau garde toujours les derniers événements (la politique de débordement est
+// ignorée) ; un lecteur trop lent pour suivre reçoit -EOVERFLOW une fois, puis reprend au plus
+// ancien événement conservé. Un nouveau lecteur ne reçoit que les événements à venir.
+static bool modeDiffusion = false;
+module_param(modeDiffusion, bool, S_IRUGO);
+MODULE_PARM_DESC(modeDiffusion, " Chaque fichier ouvert recoit tous les evenements (0 par defaut : ils sont partages)");
+
+// Avec sortieInput, chaque clavier est aussi un périphérique input (/dev/input/eventN) :
+// appuis et relâchements y sont rapportés en EV_KEY, avec l'horodatage du balayage, et
+// chaque trame se termine par un seul EV_SYN. Les codes viennent des valeurs de touches
+// (voir setr_code_input). Le fichier spécial reste disponible.
+static bool sortieInput = false;
+module_param(sortieInput, bool, S_IRUGO);
+MODULE_PARM_DESC(sortieInput, " Rapporter aussi les touches par le sous-systeme input/evdev (0 par defaut)");
+
+// Mode d'acquisition de chaque clavier au chargement : polling, irq ou hybride.
+// Il peut ensuite être changé pour chaque clavier dans /sys/class/setr/<clavier>/mode.
+static char *modeAcquisition = "hybride";
+module_param(modeAcquisition, charp, S_IRUGO);
+MODULE_PARM_DESC(modeAcquisition, " Mode d'acquisition initial : polling, irq ou hybride (defaut)");
+
+// Période de balayage adaptative (tous les modes) : tant qu'une touche est enfoncée (ou vient d'être
+// relâchée), on balaye toutes les periodeMinUs ; sinon la période est multipliée par
+// facteurRalentissement à chaque balayage inactif, jusqu'à pausePollingMs au repos.
+// periodeMinUs et pausePollingMs sont les valeurs initiales de chaque clavier, validées au
+// chargement ; elles se changent ensuite clavier par clavier avec SETR_IOC_CONFIGURER.
+// facteurRalentissement peut être modifié à chaud dans /sys/module/.../parameters.
+static unsigned int pausePollingMs = 20;
+module_param(pausePollingMs, uint, S_IRUGO);
+MODULE_PARM_DESC(pausePollingMs, " Periode maximale de polling, au repos (en ms, 20ms par defaut)");
+
+static unsigned int periodeMinUs = 1000;
+module_param(periodeMinUs, uint, S_IRUGO);
+MODULE_PARM_DESC(periodeMinUs, " Periode minimale de polling, touche active (en us, 1000us par defaut)");
+
+static unsigned int facteurRalentissement = 2;
+module_param(facteurRalentissement, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(facteurRalentissement, " Multiplicateur de la periode apres chaque balayage inactif (2 par defaut)");
+
+// Protection contre les tempêtes d'interruptions (modes irq et hybride). Dès le premier
+// front, le thread masque toutes les IRQ des colonnes et laisse passer fenetreCoalescenceUs
+// avant de balayer : les rebonds de cette fenêtre ne coûtent plus d'interruption. Les IRQ
+// restent masquées jusqu'à la fin du balayage, et au plus maxBalayagesIrq balayages par
+// seconde sont déclenchés par interruption (0 = sans limite) : un contact qui rebondit à
+// quelques kHz coûte donc un nombre borné d'interruptions et de balayages. Les fronts
+// supprimés ne sont pas rejoués ; frontsMasques en donne une borne inférieure (une par
+// colonne changée pendant le masquage).
+static unsigned int fenetreCoalescenceUs = 500;
+module_param(fenetreCoalescenceUs, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(fenetreCoalescenceUs, " Fenetre de regroupement des fronts en un seul balayage (en us, 500us par defaut)");
+
+static unsigned int maxBalayagesIrq = 500;
+module_param(maxBalayagesIrq, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(maxBalayagesIrq, " Nombre maximal de balayages declenches par interruption par seconde (500 par defaut, 0 = sans limite)");
+
+// Ordonnancement du thread d'acquisition, appliqué à sa création. Avec prioriteFifo > 0,
+// il passe en SCHED_FIFO : depuis 5.9, le noyau n'exporte plus que sched_set_fifo, qui
+// impose sa priorité (MAX_RT_PRIO / 2) ; prioriteFifo n'y vaut donc que 0 ou 1, et le
+// chargement refuse les autres valeurs. Avec cpuAcquisition >= 0, le
+// thread est fixé sur ce processeur, et les IRQ des colonnes y sont dirigées si possible.
+static int prioriteFifo = 0;
+module_param(prioriteFifo, int, S_IRUGO);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0)
+MODULE_PARM_DESC(prioriteFifo, " Thread d'acquisition en SCHED_FIFO, priorite 50 (1), ou SCHED_OTHER (0 par defaut)");
+#else
+MODULE_PARM_DESC(prioriteFifo, " Priorite SCHED_FIFO du thread d'acquisition (1 a 99, 0 = SCHED_OTHER par defaut)");
+#endif
+
+static int cpuAcquisition = -1;
+module_param(cpuAcquisition, int, S_IRUGO);
+MODULE_PARM_DESC(cpuAcquisition, " Processeur du thread d'acquisition et des IRQ des colonnes (-1 = aucun, par defaut)");
+
+// Le thread d'acquisition ne tourne que tant qu'un fichier est ouvert sur le clavier.
+// Avec amorcerEtat, l'état courant du clavier est lu au démarrage et adopté sans produire
+// d'événement : une touche déjà enfoncée à l'ouverture n'est pas signalée, et une touche
+// relâchée pendant que personne ne lisait ne produit pas de relâchement tardif.
+static bool amorcerEtat = true;
+module_param(amorcerEtat, bool, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(amorcerEtat, " Adopter l'etat du clavier au demarrage sans produire d'evenement (1 par defaut)");
+
+// Format des données retournées par read() : caractères ASCII (défaut) ou struct setr_evenement.
+// Modifiable à chaud par ioctl (SETR_IOC_CONFIGURER), pour un clavier : s'applique à ses
+// balayages suivants.
+static unsigned int modeSortie = SETR_MODE_ASCII;
+module_param(modeSortie, uint, S_IRUGO);
+MODULE_PARM_DESC(modeSortie, " Format de lecture : 0 = ASCII (defaut), 1 = evenements horodates (struct setr_evenement)");
+
+// Durées (en us) pendant lesquelles une touche doit rester dans son nouvel état avant
+// que l'appui ou le relâchement soit accepté (anti-rebond logiciel, voir filtrerRebonds).
+// Les durées sont mesurées avec les horodatages des balayages, jamais avec des pauses.
+// Valeurs initiales de chaque clavier, modifiables ensuite par SETR_IOC_CONFIGURER.
+static unsigned int debounceAppuiUs = 5000;
+module_param(debounceAppuiUs, uint, S_IRUGO);
+MODULE_PARM_DESC(debounceAppuiUs, " Duree de stabilite requise pour accepter un appui (en us, 5000us par defaut)");
+
+static unsigned int debounceRelacheUs = 5000;
+module_param(debounceRelacheUs, uint, S_IRUGO);
+MODULE_PARM_DESC(debounceRelacheUs, " Duree de stabilite requise pour accepter un relachement (en us, 5000us par defaut)");
+
+static void lireReglages(struct clavierSetr *clavier, struct reglages *r){
+    unsigned int sequence;
+
+    do {
+        sequence = read_seqbegin(&clavier->verrouReglages);
+        *r = clavier->reglages;
+    } while (read_seqretry(&clavier->verrouReglages, sequence));
+}
+
+
+static void histoAjouter(struct histogramme *h, u64 ns){
+    atomic_inc(&h->cases[min_t(int, fls64(ns), NB_CASES_HISTO - 1)]);
+}
+
+static void histoAfficher(struct seq_file *s, struct histogramme *h){
+    int i, n;
+
+    seq_printf(s, "%s (ns)\n", h->nom);
+    for (i = 0; i < NB_CASES_HISTO; i++){
+        n = atomic_read(&h->cases[i]);
+        if (n == 0)
+            continue;
+        if (i == NB_CASES_HISTO - 1)
+            seq_printf(s, "  >= %llu : %d\n", 1ULL << (i - 1), n);
+        else
+            seq_printf(s, "  [%llu, %llu[ : %d\n", i ? 1ULL << (i - 1) : 0, 1ULL << i, n);
+    }
+}
+
+static void gigueAjouter(struct gigue *g, u64 ecartNs){
+    // Les lectures par sysfs se font sans verrou : chaque champ est écrit d'un bloc
+    // div_u64 : pas de division 64 bits ouverte, que le noyau ne sait pas lier sur le Pi (32 bits)
+    int i = min_t(u64, div_u64(ecartNs, NSEC_PER_USEC), NB_CASES_GIGUE - 1);
+
+    if (g->nb == 0 || ecartNs < g->min)
+        WRITE_ONCE(g->min, ecartNs);
+    if (ecartNs > g->max)
+        WRITE_ONCE(g->max, ecartNs);
+    WRITE_ONCE(g->cases[i], g->cases[i] + 1);
+    WRITE_ONCE(g->nb, g->nb + 1);
+}
+
+static void compterBalayage(struct clavierSetr *clavier, u64 horodatage){
+    // Ajoute un balayage à la case de sa seconde. En changeant de seconde, les cases des
+    // secondes sautées (thread endormi) sont vidées avant d'être réutilisées. Les secondes
+    // tiennent en 32 bits (136 ans) : pas de modulo 64 bits, absent sur le Pi.
+    u32 seconde = div_u64(horodatage, NSEC_PER_SEC), s;
+
+    if (seconde != clavier->secondeDebit){
+        s = seconde - clavier->secondeDebit > NB_SECONDES_DEBIT ? seconde - NB_SECONDES_DEBIT : clavier->secondeDebit;
+        while (s != seconde){
+            s++;
+            WRITE_ONCE(clavier->balayagesSeconde[s % NB_SECONDES_DEBIT], 0);
+        }
+        WRITE_ONCE(clavier->secondeDebit, seconde);
+    }
+    WRITE_ONCE(clavier->balayagesSeconde[seconde % NB_SECONDES_DEBIT],
+               clavier->balayagesSeconde[seconde % NB_SECONDES_DEBIT] + 1);
+}
+
+static u64 gigueCentile99(const struct gigue *g){
+    // Borne supérieure de la case contenant le 99e centile (précision de 1 us)
+    u64 nb = READ_ONCE(g->nb), seuil = div_u64(nb * 99 + 99, 100), cumul = 0;
+    int i;
+
+    if (nb == 0)
+        return 0;
+    for (i = 0; i < NB_CASES_GIGUE - 1; i++){
+        cumul += READ_ONCE(g->cases[i]);
+        if (cumul >= seuil)
+            return (u64)(i + 1) * NSEC_PER_USEC;
+    }
+    return READ_ONCE(g->max);
+}
+
+static int latences_show(struct seq_file *s, void *donnees){
+    struct clavierSetr *clavier = s->private;
+
+    histoAfficher(s, &clavier->histoDeclenchement);
+    histoAfficher(s, &clavier->histoBalayage);
+    histoAfficher(s, &clavier->histoLecture);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(latences);
+
+// Latences balayage -> lecture d'un lot, accumulées localement pendant la copie. Les
+// horodatages sont relevés avant la vérification de la politique ecraser, en même temps
+// que les événements copiés : ils sont validés (ou jetés) avec eux. Une fois le lot
+// validé, les cases de l'anneau ne sont plus relues, le balayage a pu les réécrire.
+struct mesureLecture {
+    u64 maintenant;
+    unsigned int nombre;
+    u32 cases[NB_CASES_HISTO];
+};
+
+static void mesureDebut(struct mesureLecture *m){
+    memset(m->cases, 0, sizeof(m->cases));
+    m->nombre = 0;
+    m->maintenant = ktime_get_ns();
+}
+
+static void mesureAjouter(struct mesureLecture *m, u64 horodatage){
+    m->cases[min_t(int, fls64(m->maintenant - horodatage), NB_CASES_HISTO - 1)]++;
+    m->nombre++;
+}
+
+static void mesurerLecture(struct clavierSetr *clavier, const struct mesureLecture *m){
+    // Report d'un lot lu (et rendu à l'appelant) dans le compteur et l'histogramme
+    int i;
+
+    this_cpu_add(clavier->compteurs->evenementsLus, m->nombre);
+    for (i = 0; i < NB_CASES_HISTO; i++)
+        if (m->cases[i])
+            atomic_add(m->cases[i], &clavier->histoLecture.cases[i]);
+}
+
+static int demanderGpios(struct clavierSetr *clavier, int niveauLignes){
+    // Réserve et configure toutes les broches du clavier (lignes en sortie au niveau
+    // niveauLignes, colonnes en entrée). En cas d'échec, les broches déjà obtenues
+    // sont libérées et l'erreur est retournée.
+    int l, c, ret;
+
+    for (l = 0; l < clavier->nbLignes; l++){
+        ret = gpio_request_one(clavier->gpiosEcrire[l], niveauLignes ? GPIOF_OUT_INIT_HIGH : GPIOF_OUT_INIT_LOW, gpiosEcrireNoms[l]);
+        if (ret < 0){
+            printk(KERN_ALERT "SETR_CLAVIER : Erreur lors de la demande de la GPIO %d\n", clavier->gpiosEcrire[l]);
+            goto erreurLignes;
+        }
+        clavier->descLignes[l] = gpio_to_desc(clavier->gpiosEcrire[l]);
+    }
+    for (c = 0; c < clavier->nbColonnes; c++){
+        ret = gpio_request_one(clavier->gpiosLire[c], GPIOF_IN, gpiosLireNoms[c]);
+        if (ret < 0){
+            printk(KERN_ALERT "SETR_CLAVIER : Erreur lors de la demande de la GPIO %d\n", clavier->gpiosLire[c]);
+            goto erreurColonnes;
+        }
+        clavier->descColonnes[c] = gpio_to_desc(clavier->gpiosLire[c]);
+    }
+    return 0;
+
+erreurColonnes:
+    while (c-- > 0)
+        gpio_free(clavier->gpiosLire[c]);
+erreurLignes:
+    while (l-- > 0)
+        gpio_free(clavier->gpiosEcrire[l]);
+    return ret;
+}
+
+static void libererGpios(struct clavierSetr *clavier){
+    int i;
+
+    for (i = 0; i < clavier->nbLignes; i++){
+        gpio_set_value_cansleep(clavier->gpiosEcrire[i], 0);
+        gpio_free(clavier->gpiosEcrire[i]);
+    }
+    for (i = 0; i < clavier->nbColonnes; i++)
+        gpio_free(clavier->gpiosLire[i]);
+}
+
+// Les GPIO ne sont accédés que depuis le thread d'acquisition ou l'init du module : les
+// variantes _cansleep acceptent aussi les contrôleurs qui dorment (expandeur I2C, gpio-sim).
+
+static void ecrireLignes(void *contexte, unsigned long masque){
+    // Pilote toutes les lignes d'un seul appel : le bit i donne la valeur de la ligne i
+    struct clavierSetr *clavier = contexte;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 0, 0)
+    gpiod_set_array_value_cansleep(clavier->nbLignes, clavier->descLignes, NULL, &masque);
+#else
+    int valeurs[MAX_LIGNES], i;
+    for (i = 0; i < clavier->nbLignes; i++)
+        valeurs[i] = (masque >> i) & 1;
+    gpiod_set_array_value_cansleep(clavier->nbLignes, clavier->descLignes, valeurs);
+#endif
+}
+
+static unsigned long lireColonnes(void *contexte){
+    // Lit toutes les colonnes d'un seul appel : le bit j donne la valeur de la colonne j
+    struct clavierSetr *clavier = contexte;
+    unsigned long masque = 0;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 0, 0)
+    gpiod_get_array_value_cansleep(clavier->nbColonnes, clavier->descColonnes, NULL, &masque);
+#else
+    int valeurs[MAX_COLONNES], i;
+    gpiod_get_array_value_cansleep(clavier->nbColonnes, clavier->descColonnes, valeurs);
+    for (i = 0; i < clavier->nbColonnes; i++)
+        masque |= (unsigned long)(valeurs[i] != 0) << i;
+#endif
+    return masque & (BIT(clavier->nbColonnes) - 1);
+}
+
+static u64 filtrerRebonds(struct clavierSetr *clavier, u64 brut, u64 maintenant, const struct reglages *r){
+    // Anti-rebond de toutes les touches à la fois, touches fantômes figées (voir setr_filtrer_rebonds) :
+    // retourne le nouvel état stable, à passer à publierChangements
+    return setr_filtrer_rebonds(clavier->antirebond, &clavier->matrice, brut, maintenant,
+                                (u64)r->debounceAppuiUs * NSEC_PER_USEC,
+                                (u64)r->debounceRelacheUs * NSEC_PER_USEC);
+}
+
+static void attendrePlace(struct clavierSetr *clavier, unsigned int nb){
+    // Politique bloquer : le balayage attend que le lecteur libère nb cases. read() réveille
+    // fileProducteur ; un programme ayant projeté l'anneau ne le peut pas, d'où la vérification
+    // périodique. kthread_stop interrompt l'attente (la trame est alors rejetée).
+    struct setr_anneau *anneau = &clavier->anneau;
+
+    // Sans fichier ouvert (seulement des clients evdev), personne ne viderait l'anneau
+    if (nb > anneau->taille || READ_ONCE(clavier->nbFichiers) == 0)
+        return;
+    while (setr_anneau_libres(anneau) < nb && !kthread_should_stop())
+        wait_event_interruptible_timeout(clavier->fileProducteur,
+                                         setr_anneau_libres(anneau) >= nb || kthread_should_stop(),
+                                         msecs_to_jiffies(10));
+}
+
+static void notifierLecteurs(struct clavierSetr *clavier, int nouveaux){
+    // Appelée une fois par trame ayant ajouté des événements, jamais par touche : le nombre
+    // de réveils, de signaux et d'écritures dans l'eventfd reste borné par la cadence de balayage
+    wake_up_interruptible(&clavier->fileLecteurs);
+    kill_fasync(&clavier->fileAsync, SIGIO, POLL_IN);
+    if (READ_ONCE(clavier->eventfd)){
+        spin_lock(&clavier->verrouEventfd);
+        if (clavier->eventfd)
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 8, 0)
+            eventfd_signal(clavier->eventfd);  // Le compteur ne peut plus être augmenté que de 1
+#else
+            eventfd_signal(clavier->eventfd, nouveaux);
+#endif
+        spin_unlock(&clavier->verrouEventfd);
+    }
+}
+
+static void signalerInput(struct clavierSetr *clavier, u64 changements, u64 etat, u64 horodatage){
+    // Rapporte les touches ayant changé au sous-système input, dans l'ordre de l'anneau
+    // (relâchements puis appuis), chacune précédée de son numéro (MSC_SCAN), puis un seul
+    // EV_SYN pour toute la trame. L'horodatage est celui du balayage, pas celui de l'envoi.
+    struct input_dev *input = clavier->input;
+    u64 lots[2] = { changements & ~etat, changements & etat };
+    unsigned int touche;
+    int i;
+
+    if (changements == 0)
+        return;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 4, 0)
+    input_set_timestamp(input, ns_to_ktime(horodatage));
+#endif
+    for (i = 0; i < 2; i++){
+        while (lots[i]){
+            touche = setr_premier_bit(lots[i]);
+            lots[i] &= lots[i] - 1;
+            input_event(input, EV_MSC, MSC_SCAN, touche);
+            input_report_key(input, clavier->codesInput[touche], i);
+        }
+    }
+    input_sync(input);
+}
+
+static int publierChangements(struct clavierSetr *clavier, u64 etat, u64 horodatage, const struct reglages *r){
+    // Seules les touches ayant changé depuis le dernier état stable produisent un appui
+    // ou un relâchement. Tous ceux d'un même balayage sont publiés ensemble (une trame).
+    // Si le buffer est plein, la politique de débordement choisit ce qui est perdu ;
+    // seule la politique bloquer fait attendre le balayage.
+    // En mode ASCII, seuls les appuis sont gardés dans le buffer ; la sortie input,
+    // indépendante du buffer, reçoit toujours appuis et relâchements.
+    // Retourne le nombre d'événements ajoutés au buffer.
+    int avecRelachements = r->modeSortie == SETR_MODE_EVENEMENTS;
+    u64 changements = etat ^ clavier->antirebond->etatStable;
+    u64 perdus = clavier->anneau.perdus;
+    struct compteursSetr *compteurs;
+    unsigned long occupation;
+    int nouveaux;
+
+    if (modeDiffusion)
+        setr_anneau_oublier(&clavier->anneau, setr_nb_changements(clavier->antirebond, etat, avecRelachements));
+    else if (clavier->anneau.politique == SETR_DEBORDEMENT_BLOQUER)
+        attendrePlace(clavier, setr_nb_changements(clavier->antirebond, etat, avecRelachements));
+    nouveaux = setr_publier_changements(clavier->antirebond, &clavier->anneau, &clavier->matrice, clavier->touches,
+                                        etat, horodatage, avecRelachements);
+    // Les compteurs de l'anneau servent au coeur ; sysfs lit leurs copies par processeur,
+    // sans déchirure sur 32 bits et remises à zéro sans course avec le producteur
+    if (nouveaux > 0){
+        occupation = clavier->anneau.taille - setr_anneau_libres(&clavier->anneau);
+        compteurs = get_cpu_ptr(clavier->compteurs);    // Comparaison et écriture sur le même processeur
+        compteurs->evenementsEnfiles += nouveaux;
+        if (occupation > compteurs->occupationMax)
+            WRITE_ONCE(compteurs->occupationMax, occupation);
+        put_cpu_ptr(clavier->compteurs);
+    }
+    if (clavier->anneau.perdus != perdus)
+        this_cpu_add(clavier->compteurs->evenementsPerdus, clavier->anneau.perdus - perdus);
+    if (clavier->input)
+        signalerInput(clavier, changements, etat, horodatage);
+    return nouveaux;
+}
+
+
+static irqreturn_t setr_irq_handler(int irq, void *dev_id){
+    // Ceci est la fonction recevant l'interruption. Son seul rôle consiste à noter
+    // la colonne concernée (dev_id) et à réveiller le thread d'acquisition du clavier,
+    // qui fera le travail de balayage.
+    // Seul le premier front après l'armement réveille le thread : l'échange atomique
+    // désarme les IRQ pour tous les gestionnaires, et les fronts qui arrivent avant que
+    // le thread ne les masque (rebonds, autres colonnes) sont seulement ajoutés au
+    // balayage déjà demandé. Pendant la fenêtre de regroupement, le balayage, et en
+    // polling, les IRQ sont masquées et le gestionnaire n'est pas appelé.
+    struct colonneIrq *c = dev_id;
+    struct clavierSetr *clavier = c->clavier;
+
+    trace_setr_irq_entree(irq, c->colonne);
+    this_cpu_inc(clavier->compteurs->frontsRecus);
+    atomic_or(BIT(c->colonne), &clavier->colonnesSignalees);
+    // Les IRQ ne sont armées que par un thread d'acquisition en cours d'exécution
+    if (atomic_xchg(&clavier->irqArmees, 0)){
+        WRITE_ONCE(clavier->instantIrq, ktime_get_ns());
+        wake_up_process(READ_ONCE(clavier->task));
+    }
+    else {
+        this_cpu_inc(clavier->compteurs->frontsFusionnes);
+    }
+    return IRQ_HANDLED;
+}
+
+static void masquerIrqs(struct clavierSetr *clavier){
+    // Masque les IRQ de toutes les colonnes : le pilotage des lignes pendant le balayage
+    // fait changer les colonnes. disable_irq attend la fin des gestionnaires en cours, et
+    // IRQ_DISABLE_UNLAZY masque au niveau du contrôleur : ces fronts ne sont pas rejoués.
+    int i;
+
+    atomic_set(&clavier->irqArmees, 0);
+    if (clavier->irqMasquees)
+        return;
+    for (i = 0; i < clavier->nbColonnes; i++)
+        disable_irq(clavier->colonnesIrq[i].irq);
+    clavier->irqMasquees = true;
+}
+
+static unsigned long colonnesActives(struct clavierSetr *clavier, u64 etat){
+    // Colonnes qu'on doit lire à 1 lorsque toutes les lignes sont à 1
+    unsigned long colonnes = 0;
+    int ligne;
+
+    for (ligne = 0; ligne < clavier->nbLignes; ligne++)
+        colonnes |= (etat >> (ligne * clavier->nbColonnes)) & (BIT(clavier->nbColonnes) - 1);
+    return colonnes;
+}
+
+static void armerIrqs(struct clavierSetr *clavier){
+    // Remet toutes les lignes à 1, pour qu'un appui fasse changer sa colonne, puis
+    // démasque et arme les IRQ. Un changement survenu pendant le masquage n'a produit
+    // aucune interruption : si une colonne ne correspond pas à l'état brut connu, elle
+    // est signalée directement, et comptée dans frontsMasques. Une colonne revenue à son
+    // état d'avant (rebond complet) n'y est pas vue : le compte est une borne inférieure.
+    unsigned long manquees;
+    int i;
+
+    ecrireLignes(clavier, setr_masque_lignes(&clavier->matrice));
+    if (clavier->irqMasquees){
+        for (i = 0; i < clavier->nbColonnes; i++)
+            enable_irq(clavier->colonnesIrq[i].irq);
+        clavier->irqMasquees = false;
+    }
+    atomic_set(&clavier->irqArmees, 1);
+
+    manquees = lireColonnes(clavier) ^ colonnesActives(clavier, clavier->antirebond->etatBrut);
+    if (manquees){
+        this_cpu_add(clavier->compteurs->frontsMasques, hweight_long(manquees));
+        atomic_or(manquees, &clavier->colonnesSignalees);
+    }
+}
+
+static int acquisitionClavier(void *arg){
+    // Cette fonction contient la boucle principale du thread d'acquisition d'un clavier.
+    // Chaque clavier a son propre thread, qui reçoit son clavier en argument, et qui ne
+    // tourne que tant qu'un fichier est ouvert sur le clavier (voir dev_open).
+    // Le mode (voir modeAcquisition) est relu à chaque tour : un changement prend effet
+    // au balayage suivant, sans toucher au buffer ni perdre d'événement.
+    //  - polling : balayage complet périodique, la période ralentit au repos ;
+    //  - hybride : le thread dort jusqu'à une interruption, puis balaye à la période
+    //    minimale tant qu'une touche est enfoncée (ou en filtrage) : latence la plus faible ;
+    //  - irq : comme hybride, mais tant qu'une touche est enfoncée, un seul balayage à la
+    //    fin de chaque délai anti-rebond, sinon à la période de repos. Bien moins de
+    //    balayages par appui, mais un relâchement ou un second appui n'est vu qu'au
+    //    balayage suivant, jusqu'à pausePollingMs plus tard.
+    //  Une colonne déjà à 1 ne produit plus de front : un second appui ou un relâchement
+    //  dans cette colonne n'est vu que par le balayage périodique, d'où le polling tant
+    //  qu'une touche est enfoncée. Ces balayages sont complets, pour que la détection des
+    //  rectangles fantômes (voir setr_filtrer_rebonds) voie un instantané cohérent ; seul
+    //  le premier après l'interruption peut se limiter à une colonne (voir setr_balayer_depuis_repos).
+    struct clavierSetr *clavier = arg;
+    struct reglages reglages;
+    int nouvellesTouches, mode;
+    unsigned int max;
+    bool enAttenteIrq = false, parIrq, toucheActive;
+    u64 horodatage, etat, etatPrecedent, enAttente, periodeNs, periodeMinNs, periodeMaxNs, echeance = 0, marge = 0, fin, prochain;
+    ktime_t attente;
+    pr_debug("SETR_CLAVIER : Acquisition clavier %d declenchee\n", clavier->indice);
+
+    lireReglages(clavier, &reglages);
+    periodeNs = (u64)reglages.pausePollingMs * NSEC_PER_MSEC;
+    while(!kthread_should_stop()){           // Permet de s'arrêter en douceur lorsque kthread_stop() sera appelé
+      set_current_state(TASK_RUNNING);      // On indique qu'on est en train de faire quelque chose
+      mode = READ_ONCE(clavier->mode);
+      lireReglages(clavier, &reglages);
+
+      // 1) Les IRQ sont masquées jusqu'à ce qu'on se remette en attente. Si une interruption
+      //    nous a réveillés (le gestionnaire a désarmé les IRQ), on laisse ensuite passer la
+      //    fenêtre de regroupement : ses rebonds ne sont pas vus, le balayage lit l'état final.
+      parIrq = enAttenteIrq && atomic_xchg(&clavier->irqArmees, 0) == 0;
+      enAttenteIrq = false;
+      masquerIrqs(clavier);
+      if (parIrq){
+        prochain = READ_ONCE(clavier->instantIrq) + (u64)READ_ONCE(fenetreCoalescenceUs) * NSEC_PER_USEC;
+        horodatage = ktime_get_ns();
+        if (horodatage < prochain){
+          attente = ns_to_ktime(prochain - horodatage);
+          set_current_state(TASK_UNINTERRUPTIBLE);
+          schedule_hrtimeout(&attente, HRTIMER_MODE_REL);
+        }
+      }
+      atomic_set(&clavier->colonnesSignalees, 0);  // Le balayage relit toutes les colonnes
+      horodatage = ktime_get_ns();          // Tous les événements d'un balayage partagent le même temps
+      if (parIrq){
+        histoAjouter(&clavier->histoDeclenchement, horodatage - READ_ONCE(clavier->instantIrq));
+        this_cpu_inc(clavier->compteurs->balayagesIrq);
+        clavier->dernierBalayageIrq = horodatage;
+      }
+      else if (echeance != 0 && horodatage >= echeance){
+        histoAjouter(&clavier->histoDeclenchement, horodatage - echeance);
+        gigueAjouter(&clavier->gigue, horodatage - echeance > marge ? horodatage - echeance - marge : 0);
+      }
+
+      // 2) Balayage. Les IRQ n'ont été armées qu'au repos (toutes les touches relâchées,
+      //    toutes les lignes à 1) : au réveil, une seule colonne active ne peut pas cacher
+      //    de rectangle fantôme, et seules ses lignes sont cherchées. Sinon, toute la matrice.
+      etatPrecedent = clavier->antirebond->etatBrut;
+      trace_setr_balayage_debut(parIrq);
+      if (parIrq && etatPrecedent == 0)
+        etat = setr_balayer_depuis_repos(&clavier->matrice);
+      else
+        etat = setr_balayer_matrice(&clavier->matrice);
+
+      // 3) Filtrage des rebonds, puis comparaison avec le dernier état stable : seules les touches
+      //    ayant changé produisent un événement
+      nouvellesTouches = publierChangements(clavier, filtrerRebonds(clavier, etat, horodatage, &reglages), horodatage, &reglages);
+      fin = ktime_get_ns();
+      histoAjouter(&clavier->histoBalayage, fin - horodatage);
+      trace_setr_balayage_fin(etat, nouvellesTouches, fin - horodatage);
+      this_cpu_inc(clavier->compteurs->balayages);
+      compterBalayage(clavier, horodatage);
+      if (parIrq && etat == etatPrecedent)
+        this_cpu_inc(clavier->compteurs->irqInutiles);
+      if (fin - horodatage > clavier->dureeMaxBalayageNs)
+        WRITE_ONCE(clavier->dureeMaxBalayageNs, fin - horodatage);
+
+      // On ne réveille et ne notifie les lecteurs que si le balayage a produit des touches
+      if (nouvellesTouches > 0)
+        notifierLecteurs(clavier, nouvellesTouches);
+
+      // 4) Ajustement de la période : rapide dès qu'une touche est enfoncée ou en cours de
+      //    filtrage, puis ralentissement exponentiel jusqu'à la période de repos. En irq,
+      //    une touche enfoncée est suivie à la période de repos ; si elle est en filtrage,
+      //    le prochain balayage a lieu dès la fin de son délai anti-rebond.
+      toucheActive = (etat | clavier->antirebond->etatStable) != 0;
+      enAttente = setr_touches_en_attente(clavier->antirebond);
+      periodeMinNs = (u64)max(reglages.periodeMinUs, 100U) * NSEC_PER_USEC;
+      periodeMaxNs = max((u64)reglages.pausePollingMs * NSEC_PER_MSEC, periodeMinNs);
+      if (!toucheActive)
+        periodeNs = clamp(periodeNs * max(READ_ONCE(facteurRalentissement), 1U), periodeMinNs, periodeMaxNs);
+      else if (mode != SETR_ACQ_IRQ)
+        periodeNs = periodeMinNs;
+      else if (enAttente == 0)
+        periodeNs = periodeMaxNs;
+      else {
+        // Le délai court depuis ce balayage : l'échéance part de sa fin, pas de la précédente
+        periodeNs = clamp((u64)((enAttente & clavier->antirebond->etatBrut) ? reglages.debounceAppuiUs
+                                                                           : reglages.debounceRelacheUs) * NSEC_PER_USEC + 1,
+                          periodeMinNs, periodeMaxNs);
+        echeance = 0;
+      }
+
+      // En irq et en hybride, on reste en polling tant qu'une touche est enfoncée : sa
+      // colonne est à 1 et un autre appui ou relâchement dans celle-ci ne ferait aucun front
+      if (mode == SETR_ACQ_POLLING || toucheActive){
+        // On se met en pause jusqu'à la prochaine échéance, avec un timer haute résolution
+        // plutôt que msleep (arrondi au jiffy). Les échéances sont absolues : la période
+        // va d'un réveil prévu au suivant, la durée du balayage ne décale pas la cadence.
+        // Une échéance déjà dépassée (balayage trop long, changement de mode) repart de la fin
+        // du balayage. La marge permise au noyau pour regrouper les réveils est proportionnelle
+        // à la période : nulle en balayage rapide, et en SCHED_FIFO, où le noyau l'ignore.
+        echeance = (echeance != 0 && echeance + periodeNs > fin) ? echeance + periodeNs : fin + periodeNs;
+        attente = ns_to_ktime(echeance);
+        marge = (periodeNs > periodeMinNs && prioriteFifo == 0) ? div_u64(periodeNs, 16) : 0;
+        set_current_state(TASK_INTERRUPTIBLE); // On indique qu'on peut etre interrompu
+        schedule_hrtimeout_range(&attente, marge, HRTIMER_MODE_ABS);
+        continue;
+      }
+
+      // 5) Limitation du débit : les IRQ restent masquées jusqu'à ce qu'un nouveau balayage
+      //    déclenché par interruption soit permis
+      max = READ_ONCE(maxBalayagesIrq);
+      prochain = clavier->dernierBalayageIrq + (max > 0 ? NSEC_PER_SEC / max : 0);
+      if (fin < prochain){
+        this_cpu_inc(clavier->compteurs->limitationsDebit);
+        attente = ns_to_ktime(prochain - fin);
+        set_current_state(TASK_UNINTERRUPTIBLE);
+        schedule_hrtimeout(&attente, HRTIMER_MODE_REL);
+      }
+
+      // 6) Attente d'une interruption, toutes les touches relâchées (et acceptées comme telles).
+      //    armerIrqs peut dormir (GPIO, enable_irq) : on arme d'abord, puis on change d'état.
+      //    Un front arrivé entre les deux a déjà désarmé les IRQ et tenté de nous réveiller :
+      //    on le voit à irqArmees ou colonnesSignalees, et on ne s'endort pas.
+      echeance = 0;
+      armerIrqs(clavier);
+      enAttenteIrq = true;
+      set_current_state(TASK_INTERRUPTIBLE);
+      if (atomic_read(&clavier->irqArmees) == 0 || atomic_read(&clavier->colonnesSignalees) != 0
+          || READ_ONCE(clavier->mode) != mode || kthread_should_stop()){
+        __set_current_state(TASK_RUNNING);
+        continue;
+      }
+      schedule();
+    }
+    // Plus aucun gestionnaire ne doit réveiller ce thread une fois terminé
+    masquerIrqs(clavier);
+    pr_debug("SETR_CLAVIER : Acquisition clavier %d arretee\n", clavier->indice);
+    return 0;
+}
+
+
+static int chercherMode(const char *nom){
+    // Retourne le mode SETR_ACQ_* correspondant au nom donné, ou -EINVAL
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(nomsModes); i++)
+        if (sysfs_streq(nom, nomsModes[i]))
+            return i;
+    return -EINVAL;
+}
+
+static ssize_t mode_show(struct device *dev, struct device_attribute *attr, char *buf){
+    struct clavierSetr *clavier = dev_get_drvdata(dev);
+
+    return sprintf(buf, "%s\n", nomsModes[READ_ONCE(clavier->mode)]);
+}
+
+static void reveillerAcquisition(struct clavierSetr *clavier){
+    // Réveille le thread d'acquisition, s'il tourne, pour qu'il applique un nouveau réglage
+    // tout de suite (sinon il attendrait la prochaine interruption ou échéance)
+    mutex_lock(&clavier->verrouDemarrage);
+    if (clavier->task)
+        wake_up_process(clavier->task);
+    mutex_unlock(&clavier->verrouDemarrage);
+}
+
+static ssize_t mode_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count){
+    // Le nouveau mode s'applique tout de suite ; le buffer n'est pas touché
+    struct clavierSetr *clavier = dev_get_drvdata(dev);
+    int mode = chercherMode(buf);
+
+    if (mode < 0)
+        return mode;
+    WRITE_ONCE(clavier->mode, mode);
+    reveillerAcquisition(clavier);
+    return count;
+}
+static DEVICE_ATTR_RW(mode);
+
+static unsigned long sommeCompteurs(struct clavierSetr *clavier, size_t decalage){
+    // Additionne un compteur (décalage dans struct compteursSetr) sur tous les processeurs.
+    // Sans verrou : un incrément concurrent peut être compté ou non.
+    unsigned long total = 0;
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+        total += READ_ONCE(*(unsigned long *)((char *)per_cpu_ptr(clavier->compteurs, cpu) + decalage));
+    return total;
+}
+
+// Compteurs d'activité, en lecture seule
+#define ATTRIBUT_COMPTEUR(nom) \
+static ssize_t nom##_show(struct device *dev, struct device_attribute *attr, char *buf){ \
+    struct clavierSetr *clavier = dev_get_drvdata(dev); \
+    return sprintf(buf, "%lu\n", sommeCompteurs(clavier, offsetof(struct compteursSetr, nom))); \
+} \
+static DEVICE_ATTR_RO(nom)
+
+ATTRIBUT_COMPTEUR(balayages);
+ATTRIBUT_COMPTEUR(balayagesIrq);
+ATTRIBUT_COMPTEUR(irqInutiles);
+ATTRIBUT_COMPTEUR(frontsRecus);
+ATTRIBUT_COMPTEUR(frontsFusionnes);
+ATTRIBUT_COMPTEUR(frontsMasques);
+ATTRIBUT_COMPTEUR(limitationsDebit);
+ATTRIBUT_COMPTEUR(evenementsLus);
+
+static ssize_t balayagesParSeconde_show(struct device *dev, struct device_attribute *attr, char *buf){
+    // Balayages pendant la dernière seconde d'horloge complète (voir compterBalayage).
+    // La lecture ne change rien : tous les lecteurs voient le même débit, même après une
+    // longue période sans lecture. Une seconde que le thread n'a pas atteinte (endormi en
+    // attente d'interruption) n'a eu aucun balayage.
+    struct clavierSetr *clavier = dev_get_drvdata(dev);
+    u32 seconde = div_u64(ktime_get_ns(), NSEC_PER_SEC), derniere = READ_ONCE(clavier->secondeDebit);
+    u32 debit = 0;
+
+    if (derniere == seconde || derniere == seconde - 1)
+        debit = READ_ONCE(clavier->balayagesSeconde[(seconde - 1) % NB_SECONDES_DEBIT]);
+    return sprintf(buf, "%u\n", debit);
+}
+static DEVICE_ATTR_RO(balayagesParSeconde);
+
+static ssize_t dureeMaxBalayageNs_show(struct device *dev, struct device_attribute *attr, char *buf){
+    struct clavierSetr *clavier = dev_get_drvdata(dev);
+    return sprintf(buf, "%llu\n", READ_ONCE(clavier->dureeMaxBalayageNs));
+}
+static DEVICE_ATTR_RO(dureeMaxBalayageNs);
+
+static ssize_t occupation_show(struct device *dev, struct device_attribute *attr, char *buf){
+    // Événements actuellement en attente dans le buffer
+    struct clavierSetr *clavier = dev_get_drvdata(dev);
+    return sprintf(buf, "%u\n", setr_anneau_disponibles(&clavier->anneau));
+}
+static DEVICE_ATTR_RO(occupation);
+
+// Compteurs du buffer circulaire, copiés par publierChangements dans les compteurs par processeur
+ATTRIBUT_COMPTEUR(evenementsEnfiles);
+ATTRIBUT_COMPTEUR(evenementsPerdus);
+
+static ssize_t occupationMax_show(struct device *dev, struct device_attribute *attr, char *buf){
+    // Maximum, et non somme, des copies par processeur
+    struct clavierSetr *clavier = dev_get_drvdata(dev);
+    unsigned long occupation = 0;
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+        occupation = max(occupation, READ_ONCE(per_cpu_ptr(clavier->compteurs, cpu)->occupationMax));
+    return sprintf(buf, "%lu\n", occupation);
+}
+static DEVICE_ATTR_RO(occupationMax);
+
+// Gigue des réveils sur échéance (ns), voir struct gigue
+static ssize_t gigueMinNs_show(struct device *dev, struct device_attribute *attr, char *buf){
+    struct clavierSetr *clavier = dev_get_drvdata(dev);
+    return sprintf(buf, "%llu\n", READ_ONCE(clavier->gigue.min));
+}
+static DEVICE_ATTR_RO(gigueMinNs);
+
+static ssize_t gigueMaxNs_show(struct device *dev, struct device_attribute *attr, char *buf){
+    struct clavierSetr *clavier = dev_get_drvdata(dev);
+    return sprintf(buf, "%llu\n", READ_ONCE(clavier->gigue.max));
+}
+static DEVICE_ATTR_RO(gigueMaxNs);
+
+static ssize_t gigueP99Ns_show(struct device *dev, struct device_attribute *attr, char *buf){
+    struct clavierSetr *clavier = dev_get_drvdata(dev);
+    return sprintf(buf, "%llu\n", gigueCentile99(&clavier->gigue));
+}
+static DEVICE_ATTR_RO(gigueP99Ns);
+
+static ssize_t gigueMesures_show(struct device *dev, struct device_attribute *attr, char *buf){
+    struct clavierSetr *clavier = dev_get_drvdata(dev);
+    return sprintf(buf, "%llu\n", READ_ONCE(clavier->gigue.nb));
+}
+static DEVICE_ATTR_RO(gigueMesures);
+
+static ssize_t reinitialiser_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count){
+    // Écrire 1 remet à zéro toutes les statistiques du clavier : compteurs, buffer, gigue
+    // et histogrammes. Sans verrou avec les chemins critiques : un incrément concurrent
+    // peut survivre à la remise à zéro.
+    struct clavierSetr *clavier = dev_get_drvdata(dev);
+    bool valeur;
+    int cpu, i;
+
+    if (kstrtobool(buf, &valeur) < 0)
+        return -EINVAL;
+    if (!valeur)
+        return count;
+
+    for_each_possible_cpu(cpu)
+        memset(per_cpu_ptr(clavier->compteurs, cpu), 0, sizeof(struct compteursSetr));
+    WRITE_ONCE(clavier->dureeMaxBalayageNs, 0);
+    WRITE_ONCE(clavier->gigue.nb, 0);
+    WRITE_ONCE(clavier->gigue.min, 0);
+    WRITE_ONCE(clavier->gigue.max, 0);
+    for (i = 0; i < NB_CASES_GIGUE; i++)
+        WRITE_ONCE(clavier->gigue.cases[i], 0);
+    for (i = 0; i < NB_CASES_HISTO; i++){
+        atomic_set(&clavier->histoDeclenchement.cases[i], 0);
+        atomic_set(&clavier->histoBalayage.cases[i], 0);
+        atomic_set(&clavier->histoLecture.cases[i], 0);
+    }
+    for (i = 0; i < NB_SECONDES_DEBIT; i++)
+        WRITE_ONCE(clavier->balayagesSeconde[i], 0);
+    return count;
+}
+static DEVICE_ATTR_WO(reinitialiser);
+
+static struct attribute *setr_attrs[] = {
+    &dev_attr_mode.attr,
+    &dev_attr_balayages.attr,
+    &dev_attr_balayagesParSeconde.attr,
+    &dev_attr_balayagesIrq.attr,
+    &dev_attr_irqInutiles.attr,
+    &dev_attr_frontsRecus.attr,
+    &dev_attr_frontsFusionnes.attr,
+    &dev_attr_frontsMasques.attr,
+    &dev_attr_limitationsDebit.attr,
+    &dev_attr_dureeMaxBalayageNs.attr,
+    &dev_attr_evenementsEnfiles.attr,
+    &dev_attr_evenementsLus.attr,
+    &dev_attr_evenementsPerdus.attr,
+    &dev_attr_occupation.attr,
+    &dev_attr_occupationMax.attr,
+    &dev_attr_gigueMinNs.attr,
+    &dev_attr_gigueMaxNs.attr,
+    &dev_attr_gigueP99Ns.attr,
+    &dev_attr_gigueMesures.attr,
+    &dev_attr_reinitialiser.attr,
+    NULL,
+};
+ATTRIBUTE_GROUPS(setr);
+
+
+static int chercherPolitique(const char *nom){
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(nomsPolitiques); i++)
+        if (sysfs_streq(nom, nomsPolitiques[i]))
+            return i;
+    return -EINVAL;
+}
+
+static int verifierParametres(void){
+    // Découpe les GPIO donnés en paramètre entre les claviers et vérifie leur géométrie
+    int i, totalLignes = 0, totalColonnes = 0;
+
+    if (chercherMode(modeAcquisition) < 0){
+        printk(KERN_ALERT "SETR_CLAVIER : mode d'acquisition inconnu : %s\n", modeAcquisition);
+        return -EINVAL;
+    }
+    // Mêmes règles que SETR_IOC_CONFIGURER
+    if (periodeMinUs == 0 || periodeMinUs > (u64)pausePollingMs * USEC_PER_MSEC){
+        printk(KERN_ALERT "SETR_CLAVIER : periodeMinUs doit etre non nulle et au plus pausePollingMs\n");
+        return -EINVAL;
+    }
+    if (modeSortie > SETR_MODE_EVENEMENTS){
+        printk(KERN_ALERT "SETR_CLAVIER : modeSortie inconnu : %u\n", modeSortie);
+        return -EINVAL;
+    }
+    if (chercherPolitique(politiqueDebordement) < 0){
+        printk(KERN_ALERT "SETR_CLAVIER : politique de debordement inconnue : %s\n", politiqueDebordement);
+        return -EINVAL;
+    }
+    // Le masquage des positions du buffer circulaire exige une puissance de 2
+    if (!is_power_of_2(tailleBuffer) || tailleBuffer < MIN_TAILLE_BUFFER || tailleBuffer > MAX_TAILLE_BUFFER){
+        printk(KERN_ALERT "SETR_CLAVIER : tailleBuffer doit etre une puissance de 2 entre %d et %d\n",
+               MIN_TAILLE_BUFFER, MAX_TAILLE_BUFFER);
+        return -EINVAL;
+    }
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0)
+    if (prioriteFifo < 0 || prioriteFifo > 1){
+        printk(KERN_ALERT "SETR_CLAVIER : prioriteFifo vaut 0 ou 1 depuis Linux 5.9 (priorite imposee)\n");
+        return -EINVAL;
+    }
+#else
+    if (prioriteFifo < 0 || prioriteFifo >= MAX_RT_PRIO){
+        printk(KERN_ALERT "SETR_CLAVIER : prioriteFifo doit etre entre 0 et %d\n", MAX_RT_PRIO - 1);
+        return -EINVAL;
+    }
+#endif
+    if (cpuAcquisition >= (int)nr_cpu_ids || (cpuAcquisition >= 0 && !cpu_online(cpuAcquisition))){
+        printk(KERN_ALERT "SETR_CLAVIER : le processeur %d n'est pas disponible\n", cpuAcquisition);
+        return -EINVAL;
+    }
+
+    // Sans lignes/colonnes, un seul clavier utilise toutes les broches données
+    if (nbClaviers == 0 && nbClaviersColonnes == 0){
+        nbClaviers = nbClaviersColonnes = 1;
+        lignes[0] = nbGpiosEcrire;
+        colonnes[0] = nbGpiosLire;
+    }
+    if (nbClaviers != nbClaviersColonnes){
+        printk(KERN_ALERT "SETR_CLAVIER : lignes et colonnes doivent avoir une valeur par clavier\n");
+        return -EINVAL;
+    }
+
+    for (i = 0; i < nbClaviers; i++){
+        if (lignes[i] < 1 || lignes[i] > MAX_LIGNES || colonnes[i] < 1 || colonnes[i] > MAX_COLONNES){
+            printk(KERN_ALERT "SETR_CLAVIER : clavier %d : %dx%d n'est pas une geometrie valide (8x8 au plus)\n",
+                   i, lignes[i], colonnes[i]);
+            return -EINVAL;
+        }
+        if (strlen(touches[min(i, nbTouches - 1)]) != lignes[i] * colonnes[i]){
+            printk(KERN_ALERT "SETR_CLAVIER : clavier %d : %d valeurs de touches attendues (%zu recues)\n",
+                   i, lignes[i] * colonnes[i], strlen(touches[min(i, nbTouches - 1)]));
+            return -EINVAL;
+        }
+        totalLignes += lignes[i];
+        totalColonnes += colonnes[i];
+    }
+    if (totalLignes != nbGpiosEcrire || totalColonnes != nbGpiosLire){
+        printk(KERN_ALERT "SETR_CLAVIER : %d GPIO de lignes et %d GPIO de colonnes attendus (%d et %d recus)\n",
+               totalLignes, totalColonnes, nbGpiosEcrire, nbGpiosLire);
+        return -EINVAL;
+    }
+    return 0;
+}
+
+static void ordonnancerThread(struct task_struct *task){
+    // Applique cpuAcquisition et prioriteFifo ; kthread_bind n'est permis qu'avant
+    // le premier réveil du thread
+    if (cpuAcquisition >= 0)
+        kthread_bind(task, cpuAcquisition);
+    if (prioriteFifo > 0){
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0)
+        sched_set_fifo(task);
+#else
+        struct sched_param param = { .sched_priority = prioriteFifo };
+        sched_setscheduler_nocheck(task, SCHED_FIFO, &param);
+#endif
+    }
+}
+
+static int demarrerAcquisition(struct clavierSetr *clavier){
+    // Appelée sous verrouDemarrage, à la première ouverture. Les IRQ sont masquées et
+    // le thread arrêté : on peut lire les broches et toucher à l'état sans concurrence.
+    struct task_struct *task;
+    u64 etat;
+
+    if (READ_ONCE(amorcerEtat)){
+        etat = setr_balayer_matrice(&clavier->matrice);
+        clavier->antirebond->etatBrut = etat;
+        clavier->antirebond->fantomes = setr_touches_fantomes(&clavier->matrice, etat);
+        clavier->antirebond->etatStable = etat & ~clavier->antirebond->fantomes;
+    }
+
+    task = kthread_create(acquisitionClavier, clavier, "Thread_clavier%d", clavier->indice);
+    if (IS_ERR(task))
+        return PTR_ERR(task);
+    ordonnancerThread(task);
+    WRITE_ONCE(clavier->task, task);
+    wake_up_process(task);
+    return 0;
+}
+
+static void arreterAcquisition(struct clavierSetr *clavier){
+    // Appelée sous verrouDemarrage, à la dernière fermeture. En terminant, le thread
+    // masque et désarme les IRQ : plus rien ne tourne pour ce clavier.
+    kthread_stop(clavier->task);
+    WRITE_ONCE(clavier->task, NULL);
+}
+
+static int ajouterUtilisateur(struct clavierSetr *clavier, int fichier){
+    // Un fichier ouvert ou un client evdev de plus : le premier démarre le thread d'acquisition
+    int ret = 0;
+
+    mutex_lock(&clavier->verrouDemarrage);
+    if (clavier->nbOuvertures == 0)
+        ret = demarrerAcquisition(clavier);
+    if (ret == 0){
+        clavier->nbOuvertures++;
+        WRITE_ONCE(clavier->nbFichiers, clavier->nbFichiers + fichier);
+    }
+    mutex_unlock(&clavier->verrouDemarrage);
+    return ret;
+}
+
+static void retirerUtilisateur(struct clavierSetr *clavier, int fichier){
+    // Le dernier arrête le thread d'acquisition ; le buffer est conservé
+    mutex_lock(&clavier->verrouDemarrage);
+    WRITE_ONCE(clavier->nbFichiers, clavier->nbFichiers - fichier);
+    if (--clavier->nbOuvertures == 0)
+        arreterAcquisition(clavier);
+    mutex_unlock(&clavier->verrouDemarrage);
+}
+
+static int ouvrirInput(struct input_dev *input){
+    return ajouterUtilisateur(input_get_drvdata(input), 0);
+}
+
+static void fermerInput(struct input_dev *input){
+    retirerUtilisateur(input_get_drvdata(input), 0);
+}
+
+static int creerInput(struct clavierSetr *clavier){
+    // Enregistre le clavier auprès du sous-système input. Le thread d'acquisition est
+    // démarré à la première ouverture par un client evdev, comme pour le fichier spécial.
+    // La table des codes est indexée par le numéro de touche rapporté dans MSC_SCAN.
+    struct input_dev *input;
+    int i, ret;
+
+    input = input_allocate_device();
+    if (!input)
+        return -ENOMEM;
+    snprintf(clavier->physInput, sizeof(clavier->physInput), "setr/input%d", clavier->indice);
+    input->name = "Clavier SETR";
+    input->phys = clavier->physInput;
+    input->id.bustype = BUS_HOST;
+    input->dev.parent = clavier->device;
+    input->open = ouvrirInput;
+    input->close = fermerInput;
+    input->keycode = clavier->codesInput;
+    input->keycodesize = sizeof(clavier->codesInput[0]);
+    input->keycodemax = clavier->nbLignes * clavier->nbColonnes;
+    input_set_capability(input, EV_MSC, MSC_SCAN);
+    for (i = 0; i < clavier->nbLignes * clavier->nbColonnes; i++){
+        clavier->codesInput[i] = setr_code_input(clavier->touches[i]);
+        input_set_capability(input, EV_KEY, clavier->codesInput[i]);
+    }
+    input_set_drvdata(input, clavier);
+
+    ret = input_register_device(input);
+    if (ret < 0){
+        input_free_device(input);
+        return ret;
+    }
+    clavier->input = input;
+    return 0;
+}
+
+static void libererIrqs(struct clavierSetr *clavier, int nb){
+    // free_irq attend la fin des gestionnaires en cours
+    while (nb-- > 0){
+        irq_set_affinity_hint(clavier->colonnesIrq[nb].irq, NULL);
+        free_irq(clavier->colonnesIrq[nb].irq, &clavier->colonnesIrq[nb]);
+        irq_clear_status_flags(clavier->colonnesIrq[nb].irq, IRQ_DISABLE_UNLAZY);
+    }
+}
+
+static struct clavierSetr *creerClavier(int indice, const int *gpiosLignes, const int *gpiosColonnes){
+    // Alloue un clavier : broches, interruptions, buffer, fichier spécial et statistiques.
+    // Le thread d'acquisition n'est démarré qu'à la première ouverture (dev_open).
+    struct clavierSetr *clavier;
+    dev_t numero = premierNumero + indice;
+    int i, ret = -ENOMEM;
+
+    clavier = kzalloc(sizeof(*clavier), GFP_KERNEL);
+    if (!clavier)
+        return ERR_PTR(-ENOMEM);
+    clavier->indice = indice;
+    clavier->nbLignes = lignes[indice];
+    clavier->nbColonnes = colonnes[indice];
+    clavier->gpiosEcrire = gpiosLignes;
+    clavier->gpiosLire = gpiosColonnes;
+    clavier->touches = touches[min(indice, nbTouches - 1)];
+    seqlock_init(&clavier->verrouReglages);
+    clavier->reglages.periodeMinUs = periodeMinUs;
+    clavier->reglages.pausePollingMs = pausePollingMs;
+    clavier->reglages.debounceAppuiUs = debounceAppuiUs;
+    clavier->reglages.debounceRelacheUs = debounceRelacheUs;
+    clavier->reglages.modeSortie = modeSortie;
+    clavier->matrice.ecrireLignes = ecrireLignes;
+    clavier->matrice.lireColonnes = lireColonnes;
+    clavier->matrice.contexte = clavier;
+    clavier->matrice.nbLignes = clavier->nbLignes;
+    clavier->matrice.nbColonnes = clavier->nbColonnes;
+    clavier->histoDeclenchement.nom = "declenchement -> balayage";
+    clavier->histoBalayage.nom = "duree du balayage";
+    clavier->histoLecture.nom = "balayage -> lecture";
+    init_waitqueue_head(&clavier->fileLecteurs);
+    init_waitqueue_head(&clavier->fileProducteur);
+    spin_lock_init(&clavier->verrouEventfd);
+    mutex_init(&clavier->sync);
+    mutex_init(&clavier->verrouDemarrage);
+    clavier->mode = chercherMode(modeAcquisition);
+
+    // L'état du balayage est dimensionné selon la géométrie du clavier
+    clavier->descLignes = kcalloc(clavier->nbLignes, sizeof(*clavier->descLignes), GFP_KERNEL);
+    clavier->descColonnes = kcalloc(clavier->nbColonnes, sizeof(*clavier->descColonnes), GFP_KERNEL);
+    clavier->antirebond = kzalloc(SETR_TAILLE_ANTIREBOND(clavier->nbLignes * clavier->nbColonnes), GFP_KERNEL);
+    clavier->colonnesIrq = kcalloc(clavier->nbColonnes, sizeof(*clavier->colonnesIrq), GFP_KERNEL);
+    clavier->compteurs = alloc_percpu(struct compteursSetr);
+    if (!clavier->descLignes || !clavier->descColonnes || !clavier->antirebond || !clavier->colonnesIrq
+        || !clavier->compteurs)
+        goto erreurEtat;
+
+    // Allocation de la zone partagée (mise à zéro par vmalloc_user)
+    clavier->tailleZone = TAILLE_ZONE(tailleBuffer);
+    clavier->zonePartagee = vmalloc_user(clavier->tailleZone);
+    if (!clavier->zonePartagee){
+        printk(KERN_ALERT "SETR_CLAVIER : Erreur lors de l'allocation du buffer circulaire\n");
+        goto erreurEtat;
+    }
+    setr_anneau_init(&clavier->anneau, clavier->zonePartagee, tailleBuffer, PAGE_SIZE,
+                     modeDiffusion ? SETR_DEBORDEMENT_ECRASER : chercherPolitique(politiqueDebordement));
+
+    // Un numéro invalide fait échouer le chargement plutôt que de laisser un descripteur vide.
+    // Les lignes sont à 1 au repos pour armer les interruptions.
+    ret = demanderGpios(clavier, 1);
+    if (ret < 0)
+        goto erreurGpios;
+
+    // Les interruptions sont enregistrées avant que le fichier spécial n'existe, puis masquées
+    // jusqu'à ce qu'un thread d'acquisition les arme. irqArmees est à 0 : d'ici là, le
+    // gestionnaire ne cherche pas à réveiller de thread.
+    for (i = 0; i < clavier->nbColonnes; i++){
+        // On enregistre chaque IRQ associée à chaque GPIO, sur les deux fronts :
+        // le front descendant permet de détecter les relâchements sans attendre le prochain appui.
+        // Le gestionnaire reçoit sa colonne par dev_id et réveille le thread d'acquisition.
+        clavier->colonnesIrq[i].clavier = clavier;
+        clavier->colonnesIrq[i].colonne = i;
+        clavier->colonnesIrq[i].irq = gpio_to_irq(clavier->gpiosLire[i]);
+        irq_set_status_flags(clavier->colonnesIrq[i].irq, IRQ_DISABLE_UNLAZY);
+        ret = request_irq(clavier->colonnesIrq[i].irq, setr_irq_handler,
+                          IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING,
+                          "setr_irq_handler", &clavier->colonnesIrq[i]);
+        if (ret < 0){
+            printk(KERN_ALERT "SETR_CLAVIER : Erreur lors de l'enregistrement de l'IRQ pour la GPIO %d\n", clavier->gpiosLire[i]);
+            irq_clear_status_flags(clavier->colonnesIrq[i].irq, IRQ_DISABLE_UNLAZY);
+            goto erreurIrq;
+        }
+        if (cpuAcquisition >= 0)
+            irq_set_affinity_hint(clavier->colonnesIrq[i].irq, cpumask_of(cpuAcquisition));
+    }
+    masquerIrqs(clavier);
+
+    // Le fichier spécial de ce clavier ; open() le retrouve à partir de son cdev,
+    // et l'attribut mode à partir des données du device
+    cdev_init(&clavier->cdev, &fops);
+    clavier->cdev.owner = THIS_MODULE;
+    ret = cdev_add(&clavier->cdev, numero, 1);
+    if (ret < 0)
+        goto erreurCdev;
+    clavier->device = indice == 0 ? device_create_with_groups(setrClasse, NULL, numero, clavier, setr_groups, DEV_NAME)
+                                  : device_create_with_groups(setrClasse, NULL, numero, clavier, setr_groups, DEV_NAME "%d", indice);
+    if (IS_ERR(clavier->device)){
+        printk(KERN_ALERT "SETR_CLAVIER : Erreur lors de la creation du pilote de peripherique\n");
+        ret = PTR_ERR(clavier->device);
+        goto erreurDevice;
+    }
+
+    if (sortieInput){
+        ret = creerInput(clavier);
+        if (ret < 0){
+            printk(KERN_ALERT "SETR_CLAVIER : Erreur lors de l'enregistrement du peripherique input\n");
+            goto erreurInput;
+        }
+    }
+
+    // Les histogrammes de latence sont optionnels : une erreur de debugfs n'empêche pas le chargement
+    clavier->repertoireDebug = debugfs_create_dir(dev_name(clavier->device), repertoireDebug);
+    debugfs_create_file("latences", S_IRUGO, clavier->repertoireDebug, clavier, &latences_fops);
+
+    return clavier;
+
+erreurInput:
+    device_destroy(setrClasse, numero);
+erreurDevice:
+    cdev_del(&clavier->cdev);
+erreurCdev:
+    i = clavier->nbColonnes;
+erreurIrq:
+    libererIrqs(clavier, i);
+    libererGpios(clavier);
+erreurGpios:
+    vfree(clavier->zonePartagee);
+erreurEtat:
+    kfree(clavier->descLignes);
+    kfree(clavier->descColonnes);
+    kfree(clavier->antirebond);
+    kfree(clavier->colonnesIrq);
+    free_percpu(clavier->compteurs);
+    kfree(clavier);
+    return ERR_PTR(ret);
+}
+
+static void detruireClavier(struct clavierSetr *clavier){
+    // Plus aucun fichier n'est ouvert (le module ne peut être retiré avant). Les clients
+    // evdev, eux, sont fermés par input_unregister_device : le thread d'acquisition est
+    // alors arrêté et les IRQ masquées. On libère les interruptions, puis les GPIO.
+    if (clavier->input)
+        input_unregister_device(clavier->input);
+    libererIrqs(clavier, clavier->nbColonnes);
+    debugfs_remove_recursive(clavier->repertoireDebug);
+    device_destroy(setrClasse, premierNumero + clavier->indice);
+    cdev_del(&clavier->cdev);
+    libererGpios(clavier);
+    vfree(clavier->zonePartagee);
+    kfree(clavier->descLignes);
+    kfree(clavier->descColonnes);
+    kfree(clavier->antirebond);
+    kfree(clavier->colonnesIrq);
+    free_percpu(clavier->compteurs);
+    kfree(clavier);
+}
+
+
+static int __init setrclavier_init(void){
+    const int *gpiosLignes = gpiosEcrire, *gpiosColonnes = gpiosLire;
+    int i, ret;
+    printk(KERN_INFO "SETR_CLAVIER : Initialisation du driver commencee\n");
+
+    ret = verifierParametres();
+    if (ret < 0)
+      return ret;
+
+    // On réserve un numéro mineur par clavier
+    ret = alloc_chrdev_region(&premierNumero, 0, nbClaviers, DEV_NAME);
+    if (ret < 0){
+      printk(KERN_ALERT "SETR_CLAVIER : Erreur lors de l'appel a alloc_chrdev_region!\n");
+      return ret;
+    }
+
+    // Création de la classe de périphérique
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+    setrClasse = class_create(CLS_NAME);                // Le paramètre owner a disparu en 6.4
+#else
+    setrClasse = class_create(THIS_MODULE, CLS_NAME);
+#endif
+    if (IS_ERR(setrClasse)){
+      unregister_chrdev_region(premierNumero, nbClaviers);
+      printk(KERN_ALERT "SETR_CLAVIER : Erreur lors de la creation de la classe de peripherique\n");
+      return PTR_ERR(setrClasse);
+    }
+
+    repertoireDebug = debugfs_create_dir("setr_clavier", NULL);
+
+    // Création de chaque clavier, avec ses propres broches
+    for (i = 0; i < nbClaviers; i++){
+      claviers[i] = creerClavier(i, gpiosLignes, gpiosColonnes);
+      if (IS_ERR(claviers[i])){
+        ret = PTR_ERR(claviers[i]);
+        goto erreurClavier;
+      }
+      gpiosLignes += lignes[i];
+      gpiosColonnes += colonnes[i];
+    }
+
+    printk(KERN_INFO "SETR_CLAVIER : Fin de l'Initialisation! (%d clavier(s))\n", nbClaviers); // Made it! device was initialized
+
+    return 0;
+
+erreurClavier:
+    while (i-- > 0)
+      detruireClavier(claviers[i]);
+    debugfs_remove_recursive(repertoireDebug);
+    class_destroy(setrClasse);
+    unregister_chrdev_region(premierNumero, nbClaviers);
+    return ret;
+}
+
+
+static void __exit setrclavier_exit(void){
+    int i;
+
+    // On arrête et on libère chaque clavier (interruptions, thread, GPIO, fichier spécial, buffer)
+    for (i = 0; i < nbClaviers; i++)
+      detruireClavier(claviers[i]);
+
+    // On retire correctement les différentes composantes du pilote
+    debugfs_remove_recursive(repertoireDebug);
+    class_destroy(setrClasse);
+    unregister_chrdev_region(premierNumero, nbClaviers);
+    printk(KERN_INFO "SETR_CLAVIER : Terminaison du driver\n");
+}
+
+
+static int dev_open(struct inode *inodep, struct file *filep){
+    // Chaque fichier ouvert retient le clavier auquel il correspond, et sa position de
+    // lecture en mode diffusion. La première ouverture démarre le thread d'acquisition.
+    struct clavierSetr *clavier = container_of(inodep->i_cdev, struct clavierSetr, cdev);
+    struct lecteurSetr *lecteur;
+    int ret;
+
+    lecteur = kzalloc(sizeof(*lecteur), GFP_KERNEL);
+    if (!lecteur)
+        return -ENOMEM;
+    lecteur->clavier = clavier;
+    mutex_init(&lecteur->sync);
+    ret = ajouterUtilisateur(clavier, 1);
+    if (ret < 0){
+        kfree(lecteur);
+        return ret;
+    }
+    lecteur->lecture = setr_anneau_fin(&clavier->anneau);
+    filep->private_data = lecteur;
+    return 0;
+}
+static long enregistrerEventfd(struct lecteurSetr *lecteur, int fd){
+    // Remplace (ou retire, fd < 0) l'eventfd du clavier. Seul le fichier qui l'a enregistré
+    // peut le changer ; il est retiré à la fermeture de ce fichier.
+    struct clavierSetr *clavier = lecteur->clavier;
+    struct eventfd_ctx *ctx = NULL, *ancien;
+
+    if (fd >= 0){
+        ctx = eventfd_ctx_fdget(fd);
+        if (IS_ERR(ctx))
+            return PTR_ERR(ctx);
+    }
+    spin_lock(&clavier->verrouEventfd);
+    if (clavier->eventfd && clavier->proprioEventfd != lecteur){
+        spin_unlock(&clavier->verrouEventfd);
+        if (ctx)
+            eventfd_ctx_put(ctx);
+        return -EBUSY;
+    }
+    ancien = clavier->eventfd;
+    WRITE_ONCE(clavier->eventfd, ctx);
+    clavier->proprioEventfd = ctx ? lecteur : NULL;
+    spin_unlock(&clavier->verrouEventfd);
+
+    if (ancien)
+        eventfd_ctx_put(ancien);
+    return 0;
+}
+
+static int dev_release(struct inode *inodep, struct file *filep){
+    // La dernière fermeture arrête le thread d'acquisition ; le buffer est conservé
+    struct lecteurSetr *lecteur = filep->private_data;
+
+    dev_fasync(-1, filep, 0);
+    if (READ_ONCE(lecteur->clavier->proprioEventfd) == lecteur)
+        enregistrerEventfd(lecteur, -1);
+    retirerUtilisateur(lecteur->clavier, 1);
+    kfree(lecteur);
+    return 0;
+}
+
+static unsigned int positionLecture(struct lecteurSetr *lecteur, unsigned int fin){
+    // Position du prochain événement à lire pour ce fichier. En mode diffusion, un lecteur
+    // dépassé par le balayage est ramené au plus ancien événement conservé, et le saura.
+    struct setr_anneau *anneau = &lecteur->clavier->anneau;
+
+    if (!modeDiffusion)
+        return setr_anneau_position_lecture(anneau, fin);
+    if (fin - lecteur->lecture > anneau->taille){
+        lecteur->lecture = fin - anneau->taille;
+        lecteur->depasse = true;
+    }
+    return lecteur->lecture;
+}
+
+static void avancerLecture(struct lecteurSetr *lecteur, unsigned int lecture){
+    // Release (mode partagé) : le balayage ne réutilise les cases qu'une fois la copie terminée
+    if (modeDiffusion)
+        WRITE_ONCE(lecteur->lecture, lecture);
+    else
+        setr_anneau_liberer(&lecteur->clavier->anneau, lecture);
+}
+
+static struct mutex *verrouLecture(struct lecteurSetr *lecteur){
+    // Mutex sérialisant les lectures qui partagent la position de ce fichier
+    return modeDiffusion ? &lecteur->sync : &lecteur->clavier->sync;
+}
+
+static unsigned int evenementsDisponibles(struct lecteurSetr *lecteur){
+    // Acquire : les événements sont visibles avant la position d'écriture.
+    // En mode diffusion, un lecteur dépassé a aussi quelque chose à lire : l'erreur.
+    struct setr_anneau *anneau = &lecteur->clavier->anneau;
+
+    if (!modeDiffusion)
+        return setr_anneau_disponibles(anneau);
+    return setr_anneau_fin(anneau) - READ_ONCE(lecteur->lecture) + READ_ONCE(lecteur->depasse);
+}
+
+static ssize_t lireEvenements(struct lecteurSetr *lecteur, struct iov_iter *dest){
+    // Mode SETR_MODE_EVENEMENTS : copie autant d'événements complets que la destination
+    // (un ou plusieurs tampons avec readv) peut en contenir. Le buffer étant circulaire,
+    // les données sont copiées en au plus deux morceaux : de la position de lecture
+    // jusqu'à la fin du tableau, puis à partir du début.
+    // Avec la politique ecraser, le balayage a pu réécrire des cases pendant la copie :
+    // elle est alors annulée (iov_iter_revert) et reprise à la première case encore valide.
+    // En mode diffusion, on s'arrête plutôt avant la perte, pour la signaler.
+    struct clavierSetr *clavier = lecteur->clavier;
+    struct setr_anneau *anneau = &clavier->anneau;
+    struct mesureLecture mesure;
+    unsigned int fin, lecture, premier, premierSegment, n, i;
+    size_t copies;
+    const size_t taille = sizeof(struct setr_evenement);
+
+    if (iov_iter_count(dest) < taille)
+        return -EINVAL;
+
+    // Acquire : les événements écrits par le balayage sont visibles avant la position
+    fin = setr_anneau_fin(anneau);
+    lecture = positionLecture(lecteur, fin);
+    if (lecteur->depasse)
+        return 0;
+    for (;;){
+        n = min_t(size_t, fin - lecture, iov_iter_count(dest) / taille);
+        premierSegment = setr_anneau_segment(anneau, lecture, n);
+        copies = copy_to_iter(setr_anneau_case(anneau, lecture), premierSegment * taille, dest);
+        if (copies == premierSegment * taille && n > premierSegment)
+            copies += copy_to_iter(anneau->evenements, (n - premierSegment) * taille, dest);
+        // Horodatages des événements copiés, relevés avant la vérification ci-dessous
+        mesureDebut(&mesure);
+        for (i = 0; i < copies / taille; i++)
+            mesureAjouter(&mesure, READ_ONCE(setr_anneau_case(anneau, lecture + i)->horodatageNs));
+
+        premier = setr_anneau_premier_valide(anneau, lecture);
+        if (premier == lecture)
+            break;
+        // Des cases ont été réécrites pendant la copie : on recommence après elles
+        iov_iter_revert(dest, copies);
+        lecture = premier;
+        fin = setr_anneau_fin(anneau);
+        avancerLecture(lecteur, lecture);
+        if (modeDiffusion){
+            lecteur->depasse = true;
+            return 0;
+        }
+    }
+
+    // On n'avance que des événements entièrement copiés : un morceau d'événement est rendu
+    iov_iter_revert(dest, copies % taille);
+    n = copies / taille;
+    mesurerLecture(clavier, &mesure);
+    avancerLecture(lecteur, lecture + n);
+    trace_setr_defilage(n, lecture + n);
+
+    if (n == 0 && lecture != fin)
+        return -EFAULT;
+    return n * taille;
+}
+
+static ssize_t lireCaracteres(struct lecteurSetr *lecteur, struct iov_iter *dest){
+    // Mode SETR_MODE_ASCII : un caractère par appui, les relâchements sont ignorés.
+    // Les caractères sont regroupés dans un petit tampon avant chaque copy_to_iter.
+    struct clavierSetr *clavier = lecteur->clavier;
+    struct setr_anneau *anneau = &clavier->anneau;
+    char tampon[64];
+    struct mesureLecture mesure;
+    // Acquire : les événements écrits par le balayage sont visibles avant la position
+    unsigned int fin = setr_anneau_fin(anneau);
+    unsigned int lecture = positionLecture(lecteur, fin);
+    unsigned int debutLot, premier;
+    const struct setr_evenement *ev;
+    size_t copies = 0, n, len = iov_iter_count(dest), k;
+
+    if (lecteur->depasse)
+        return 0;
+    while (lecture != fin && copies < len){
+        debutLot = lecture;
+        n = 0;
+        mesureDebut(&mesure);
+        while (lecture != fin && n < sizeof(tampon) && copies + n < len){
+            ev = setr_anneau_case(anneau, lecture);
+            if (SETR_EV_TYPE(ev->type) == SETR_EV_APPUI)
+                tampon[n++] = ev->code;
+            mesureAjouter(&mesure, READ_ONCE(ev->horodatageNs));
+            lecture++;
+        }
+        // Politique ecraser : si des cases du lot ont été réécrites pendant la copie,
+        // le lot est jeté et on reprend à la première case encore valide (après avoir
+        // rendu ce qui précède la perte, en mode diffusion)
+        premier = setr_anneau_premier_valide(anneau, debutLot);
+        if (premier != debutLot){
+            lecture = premier;
+            fin = setr_anneau_fin(anneau);
+            avancerLecture(lecteur, lecture);
+            if (modeDiffusion){
+                lecteur->depasse = true;
+                return copies;
+            }
+            continue;
+        }
+        // Un lot copié en partie est rendu en entier : il sera relu au prochain appel
+        k = copy_to_iter(tampon, n, dest);
+        if (k != n){
+            iov_iter_revert(dest, k);
+            lecture = debutLot;
+            break;
+        }
+        copies += n;
+        mesurerLecture(clavier, &mesure);
+        // On n'avance que de ce qui a réellement été copié
+        avancerLecture(lecteur, lecture);
+        trace_setr_defilage(lecture - debutLot, lecture);
+    }
+
+    if (copies == 0 && lecture != fin)
+        return -EFAULT;
+    return copies;
+}
+
+static ssize_t dev_read_iter(struct kiocb *iocb, struct iov_iter *dest){
+    // Copie dans les tampons de l'appelant (read, readv, preadv) le minimum entre ce qui
+    // est disponible et ce qui est demandé, dans le format choisi par modeSortie.
+    // Le mutex ne sérialise que les lecteurs entre eux (ceux d'un même fichier en mode
+    // diffusion) : le balayage n'y touche jamais, la synchronisation avec lui se fait par
+    // barrières acquire/release.
+    // Le fichier est un flux : la position (ki_pos) est ignorée.
+    struct lecteurSetr *lecteur = iocb->ki_filp->private_data;
+    struct clavierSetr *clavier = lecteur->clavier;
+    struct mutex *sync = verrouLecture(lecteur);
+    bool nonBloquant = (iocb->ki_filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+    ssize_t ret;
+
+    if (iov_iter_count(dest) == 0)
+        return 0;
+
+    if (iocb->ki_flags & IOCB_NOWAIT){
+        if (!mutex_trylock(sync))
+            return -EAGAIN;
+    }
+    else if (mutex_lock_interruptible(sync))
+        return -ERESTARTSYS;
+
+    do {
+        // Mode diffusion : des événements ont été écrasés avant que ce fichier les lise.
+        // On le signale une fois ; la lecture suivante reprend après la perte.
+        if (lecteur->depasse){
+            WRITE_ONCE(lecteur->depasse, false);
+            ret = -EOVERFLOW;
+            break;
+        }
+
+        // Rien à lire : on dort jusqu'à ce que le balayage réveille les lecteurs,
+        // sauf si le fichier a été ouvert en mode non bloquant
+        while (evenementsDisponibles(lecteur) == 0){
+            mutex_unlock(sync);
+            if (nonBloquant)
+                return -EAGAIN;
+            if (wait_event_interruptible(clavier->fileLecteurs, evenementsDisponibles(lecteur) > 0))
+                return -ERESTARTSYS;
+            if (mutex_lock_interruptible(sync))
+                return -ERESTARTSYS;
+        }
+
+        if (READ_ONCE(clavier->reglages.modeSortie) == SETR_MODE_EVENEMENTS)
+            ret = lireEvenements(lecteur, dest);
+        else
+            ret = lireCaracteres(lecteur, dest);
+    // Un lot ne contenant que des relâchements ne produit aucun caractère : on attend la suite
+    } while (ret == 0);
+
+    mutex_unlock(sync);
+    // Politique bloquer : le balayage attend peut-être la place qui vient d'être libérée
+    if (ret > 0 && !modeDiffusion)
+        wake_up_interruptible(&clavier->fileProducteur);
+    return ret;
+}
+
+static __poll_t dev_poll(struct file *filep, poll_table *wait){
+    // Le fichier est lisible dès qu'au moins un événement attend dans le buffer
+    // (ou, en mode diffusion, qu'une perte attend d'être signalée)
+    struct lecteurSetr *lecteur = filep->private_data;
+
+    poll_wait(filep, &lecteur->clavier->fileLecteurs, wait);
+    if (evenementsDisponibles(lecteur) > 0)
+        return EPOLLIN | EPOLLRDNORM;
+    return 0;
+}
+
+static int dev_mmap(struct file *filep, struct vm_area_struct *vma){
+    // Projette l'en-tête et les événements de l'anneau dans l'espace utilisateur.
+    // Le consommateur peut alors vider l'anneau sans appel système, en avançant
+    // lui-même entete->lecture, et n'utiliser poll() que lorsque l'anneau est vide.
+    // En mode diffusion, entete->lecture appartient au pilote (plus ancien événement
+    // conservé) : la projection est en lecture seule, et chaque programme garde sa position.
+    struct clavierSetr *clavier = ((struct lecteurSetr *)filep->private_data)->clavier;
+
+    if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start > clavier->tailleZone)
+        return -EINVAL;
+    if (modeDiffusion){
+        if (vma->vm_flags & VM_WRITE)
+            return -EACCES;
+        // Sans quoi mprotect(PROT_WRITE) rendrait la projection inscriptible après coup
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+        vm_flags_clear(vma, VM_MAYWRITE);
+#else
+        vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+    }
+    return remap_vmalloc_range(vma, clavier->zonePartagee, 0);
+}
+
+static int dev_fasync(int fd, struct file *filep, int active){
+    // fcntl(F_SETFL, O_ASYNC) : SIGIO est envoyé à chaque trame ajoutant des événements
+    struct lecteurSetr *lecteur = filep->private_data;
+
+    return fasync_helper(fd, filep, active, &lecteur->clavier->fileAsync);
+}
+
+static unsigned int compterEnAttente(struct lecteurSetr *lecteur, bool octets){
+    // Nombre d'événements en attente pour ce fichier, ou nombre d'octets qu'un read()
+    // retournerait (en mode ASCII, un par appui). Instantané sans verrou.
+    struct setr_anneau *anneau = &lecteur->clavier->anneau;
+    unsigned int fin = setr_anneau_fin(anneau), lecture, n, appuis = 0;
+
+    lecture = modeDiffusion ? READ_ONCE(lecteur->lecture) : setr_anneau_position_lecture(anneau, fin);
+    n = min(fin - lecture, anneau->taille);
+    if (!octets)
+        return n;
+    if (READ_ONCE(lecteur->clavier->reglages.modeSortie) == SETR_MODE_EVENEMENTS)
+        return n * sizeof(struct setr_evenement);
+    for (lecture = fin - n; lecture != fin; lecture++)
+        appuis += SETR_EV_TYPE(setr_anneau_case(anneau, lecture)->type) == SETR_EV_APPUI;
+    return appuis;
+}
+
+static long vider(struct lecteurSetr *lecteur){
+    // Abandonne les événements en attente pour ce fichier ; le balayage n'est pas interrompu
+    struct clavierSetr *clavier = lecteur->clavier;
+    struct mutex *sync = verrouLecture(lecteur);
+
+    if (mutex_lock_interruptible(sync))
+        return -ERESTARTSYS;
+    avancerLecture(lecteur, setr_anneau_fin(&clavier->anneau));
+    lecteur->depasse = false;
+    mutex_unlock(sync);
+    if (!modeDiffusion)
+        wake_up_interruptible(&clavier->fileProducteur);
+    return 0;
+}
+
+static long configurer(struct file *filep, const struct setr_config __user *arg){
+    // Valide tout le lot avant d'en appliquer la moindre partie, puis l'applique d'un bloc
+    // au clavier du fichier (voir lireReglages). Son thread d'acquisition est réveillé pour
+    // l'adopter aussitôt ; les autres claviers ne sont pas touchés.
+    struct lecteurSetr *lecteur = filep->private_data;
+    struct clavierSetr *clavier = lecteur->clavier;
+    struct reglages *r = &clavier->reglages;
+    struct setr_config config;
+    u32 periodeMin, pause;
+
+    if (!(filep->f_mode & FMODE_WRITE))
+        return -EBADF;
+    if (copy_from_user(&config, arg, sizeof(config)))
+        return -EFAULT;
+    if (config.champs & ~SETR_CFG_TOUS)
+        return -EINVAL;
+    if ((config.champs & SETR_CFG_MODE_SORTIE) && config.modeSortie > SETR_MODE_EVENEMENTS)
+        return -EINVAL;
+
+    write_seqlock(&clavier->verrouReglages);
+    // Les deux périodes se valident ensemble, avec la valeur courante de celle qui n'est
+    // pas dans le lot : sous le verrou, pour qu'un autre appel ne s'intercale pas
+    if (config.champs & (SETR_CFG_PERIODE_MIN | SETR_CFG_PAUSE_POLLING)){
+        periodeMin = (config.champs & SETR_CFG_PERIODE_MIN) ? config.periodeMinUs : r->periodeMinUs;
+        pause = (config.champs & SETR_CFG_PAUSE_POLLING) ? config.pausePollingMs : r->pausePollingMs;
+        if (periodeMin == 0 || periodeMin > (u64)pause * USEC_PER_MSEC){
+            write_sequnlock(&clavier->verrouReglages);
+            return -EINVAL;
+        }
+    }
+    if (config.champs & SETR_CFG_PERIODE_MIN)
+        r->periodeMinUs = config.periodeMinUs;
+    if (config.champs & SETR_CFG_PAUSE_POLLING)
+        r->pausePollingMs = config.pausePollingMs;
+    if (config.champs & SETR_CFG_DEBOUNCE_APPUI)
+        r->debounceAppuiUs = config.debounceAppuiUs;
+    if (config.champs & SETR_CFG_DEBOUNCE_RELACHE)
+        r->debounceRelacheUs = config.debounceRelacheUs;
+    // Aussi lu hors du verrou, par read() et poll()
+    if (config.champs & SETR_CFG_MODE_SORTIE)
+        WRITE_ONCE(r->modeSortie, config.modeSortie);
+    write_sequnlock(&clavier->verrouReglages);
+
+    reveillerAcquisition(clavier);
+    return 0;
+}
+
+static long lireConfig(struct lecteurSetr *lecteur, struct setr_config __user *arg){
+    struct setr_config config = { .champs = SETR_CFG_TOUS };
+    struct reglages r;
+
+    lireReglages(lecteur->clavier, &r);
+    config.periodeMinUs = r.periodeMinUs;
+    config.pausePollingMs = r.pausePollingMs;
+    config.debounceAppuiUs = r.debounceAppuiUs;
+    config.debounceRelacheUs = r.debounceRelacheUs;
+    config.modeSortie = r.modeSortie;
+    return copy_to_user(arg, &config, sizeof(config)) ? -EFAULT : 0;
+}
+
+static long dev_ioctl(struct file *filep, unsigned int commande, unsigned long arg){
+    // Commandes de contrôle, voir SETR_IOC_* dans setr_clavier.h
+    struct lecteurSetr *lecteur = filep->private_data;
+    int fd;
+
+    switch (commande){
+    case SETR_IOC_EVENTFD:
+        if (get_user(fd, (int __user *)arg))
+            return -EFAULT;
+        return enregistrerEventfd(lecteur, fd);
+    case SETR_IOC_NB_EVENEMENTS:
+        return put_user(compterEnAttente(lecteur, false), (__u32 __user *)arg);
+    case FIONREAD:
+        return put_user(compterEnAttente(lecteur, true), (int __user *)arg);
+    case SETR_IOC_VIDER:
+        return vider(lecteur);
+    case SETR_IOC_LIRE_CONFIG:
+        return lireConfig(lecteur, (struct setr_config __user *)arg);
+    case SETR_IOC_CONFIGURER:
+        return configurer(filep, (const struct setr_config __user *)arg);
+    default:
+        return -ENOTTY;
+    }
+}
+
+
+// On enregistre les fonctions d'initialisation et de destruction
+module_init(setrclavier_init);
+module_exit(setrclavier_exit);
+
+// Description du module
+MODULE_LICENSE("GPL");            // Licence : laissez "GPL"
+MODULE_AUTHOR("Vous!");           // Vos noms
+MODULE_DESCRIPTION("Lecteur de clavier externe, par polling, interruptions ou hybride");  // Description du module
+MODULE_VERSION("0.4");            // Numéro de version
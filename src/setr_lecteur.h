@@ -0,0 +1,140 @@
+/******************************************************************************
+* H2023
+* LABORATOIRE 4, Systèmes embarqués et temps réel
+* Petite bibliothèque (en-tête seulement) de lecture sans appel système
+*
+* Projette l'anneau d'événements de /dev/claviersetr dans le processus et le
+* vide directement en mémoire partagée. poll() n'est utilisé que pour dormir
+* lorsque l'anneau est vide. Ce fichier est destiné aux programmes utilisateur,
+* pas aux pilotes.
+*
+* Exemple :
+*     struct setr_lecteur l;
+*     struct setr_evenement ev[32];
+*     if (setr_lecteur_ouvrir(&l, "/dev/claviersetr") < 0) ...
+*     for (;;) {
+*         unsigned int n = setr_lecteur_extraire(&l, ev, 32);
+*         if (n == 0) setr_lecteur_attendre(&l, -1);
+*         ...
+*     }
+*/
+#ifndef SETR_LECTEUR_H
+#define SETR_LECTEUR_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "setr_clavier.h"
+
+struct setr_lecteur {
+    int fd;
+    void *zone;                             // Zone projetée (en-tête + événements)
+    size_t tailleZone;
+    struct setr_anneau_entete *entete;
+    const struct setr_evenement *evenements;
+    __u32 masque;                           // entete->taille - 1
+};
+
+// Ouvre le périphérique et projette son anneau. Retourne 0, ou -errno en cas d'erreur.
+static inline int setr_lecteur_ouvrir(struct setr_lecteur *l, const char *chemin){
+    long page = sysconf(_SC_PAGESIZE);
+    struct setr_anneau_entete *entete;
+    int err;
+
+    memset(l, 0, sizeof(*l));
+    // O_RDWR : la position de lecture est écrite dans la zone partagée
+    l->fd = open(chemin, O_RDWR | O_NONBLOCK);
+    if (l->fd < 0)
+        return -errno;
+
+    // On projette d'abord l'en-tête seul pour connaître la taille de l'anneau
+    entete = mmap(NULL, page, PROT_READ, MAP_SHARED, l->fd, 0);
+    if (entete == MAP_FAILED)
+        goto erreur;
+    l->tailleZone = entete->decalage + (size_t)entete->taille * sizeof(struct setr_evenement);
+    l->masque = entete->taille - 1;
+    munmap(entete, page);
+
+    l->zone = mmap(NULL, l->tailleZone, PROT_READ | PROT_WRITE, MAP_SHARED, l->fd, 0);
+    if (l->zone == MAP_FAILED)
+        goto erreur;
+    l->entete = l->zone;
+    l->evenements = (const struct setr_evenement *)((const char *)l->zone + l->entete->decalage);
+    return 0;
+
+erreur:
+    err = -errno;
+    close(l->fd);
+    l->fd = -1;
+    l->zone = NULL;
+    return err;
+}
+
+static inline void setr_lecteur_fermer(struct setr_lecteur *l){
+    if (l->zone)
+        munmap(l->zone, l->tailleZone);
+    if (l->fd >= 0)
+        close(l->fd);
+    l->zone = NULL;
+    l->fd = -1;
+}
+
+// Nombre d'événements en attente, sans appel système
+static inline unsigned int setr_lecteur_disponibles(const struct setr_lecteur *l){
+    __u32 n = __atomic_load_n(&l->entete->ecriture, __ATOMIC_ACQUIRE) - l->entete->lecture;
+    return n > l->masque + 1 ? l->masque + 1 : n;
+}
+
+// Copie au plus max événements dans dest et les retire de l'anneau, sans appel système.
+// Retourne le nombre d'événements copiés (0 si l'anneau est vide).
+// Si le pilote écrase les anciens événements (politique ecraser), ceux qu'il a réécrits
+// avant ou pendant la copie sont sautés ; le trou se voit dans les numéros de séquence.
+static inline unsigned int setr_lecteur_extraire(struct setr_lecteur *l,
+                                                 struct setr_evenement *dest, unsigned int max){
+    __u32 taille = l->masque + 1;
+    __u32 ecriture, lecture, reservee, jetes;
+    unsigned int n, i;
+
+    for (;;){
+        ecriture = __atomic_load_n(&l->entete->ecriture, __ATOMIC_ACQUIRE);
+        lecture = l->entete->lecture;
+        if (ecriture - lecture > taille)
+            lecture = ecriture - taille;        // Dépassé par le pilote : le retard est perdu
+        n = ecriture - lecture < max ? ecriture - lecture : max;
+        for (i = 0; i < n; i++)
+            dest[i] = l->evenements[(lecture + i) & l->masque];
+
+        // Les cases que le pilote a commencé à réécrire pendant la copie sont jetées
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        reservee = __atomic_load_n(&l->entete->ecritureReservee, __ATOMIC_RELAXED);
+        jetes = reservee - lecture > taille ? reservee - taille - lecture : 0;
+        // Release : le pilote ne réutilise les cases qu'une fois copiées
+        __atomic_store_n(&l->entete->lecture, lecture + n, __ATOMIC_RELEASE);
+        if (jetes < n){
+            if (jetes > 0)
+                memmove(dest, dest + jetes, (n - jetes) * sizeof(*dest));
+            return n - jetes;
+        }
+        if (n == 0)
+            return 0;
+    }
+}
+
+// Dort jusqu'à ce qu'au moins un événement soit disponible, ou jusqu'à delaiMs
+// (-1 : pas de limite). Retourne > 0 si des événements sont disponibles, 0 à
+// l'expiration du délai, -errno en cas d'erreur.
+static inline int setr_lecteur_attendre(struct setr_lecteur *l, int delaiMs){
+    struct pollfd pfd = { .fd = l->fd, .events = POLLIN };
+    int ret;
+
+    if (setr_lecteur_disponibles(l) > 0)
+        return 1;
+    ret = poll(&pfd, 1, delaiMs);
+    return ret < 0 ? -errno : ret;
+}
+
+#endif
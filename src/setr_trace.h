@@ -0,0 +1,115 @@
+/******************************************************************************
+* H2023
+* LABORATOIRE 4, Systèmes embarqués et temps réel
+* Points de trace (TRACE_EVENT) des pilotes du clavier
+*
+* Remplacent les printk des chemins critiques : activés au besoin avec
+*     echo 1 > /sys/kernel/debug/tracing/events/setr_clavier/enable
+* puis lus dans trace_pipe, ou enregistrés avec perf/trace-cmd.
+* Un seul fichier .c par module doit définir CREATE_TRACE_POINTS avant de l'inclure.
+*/
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM setr_clavier
+
+#if !defined(SETR_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define SETR_TRACE_H
+
+#include <linux/tracepoint.h>
+
+#include "setr_clavier.h"
+
+// Entrée dans le gestionnaire d'interruption d'une colonne
+TRACE_EVENT(setr_irq_entree,
+    TP_PROTO(int irq, int colonne),
+    TP_ARGS(irq, colonne),
+    TP_STRUCT__entry(
+        __field(int, irq)
+        __field(int, colonne)
+    ),
+    TP_fast_assign(
+        __entry->irq = irq;
+        __entry->colonne = colonne;
+    ),
+    TP_printk("irq=%d colonne=%d", __entry->irq, __entry->colonne)
+);
+
+// Début d'un balayage : parIrq vaut 1 s'il a été déclenché par une interruption,
+// 0 par l'échéance du polling
+TRACE_EVENT(setr_balayage_debut,
+    TP_PROTO(int parIrq),
+    TP_ARGS(parIrq),
+    TP_STRUCT__entry(
+        __field(int, parIrq)
+    ),
+    TP_fast_assign(
+        __entry->parIrq = parIrq;
+    ),
+    TP_printk("parIrq=%d", __entry->parIrq)
+);
+
+// Fin d'un balayage : état brut lu, nombre d'événements produits et durée
+TRACE_EVENT(setr_balayage_fin,
+    TP_PROTO(u64 etat, int nouveaux, u64 dureeNs),
+    TP_ARGS(etat, nouveaux, dureeNs),
+    TP_STRUCT__entry(
+        __field(u64, etat)
+        __field(int, nouveaux)
+        __field(u64, dureeNs)
+    ),
+    TP_fast_assign(
+        __entry->etat = etat;
+        __entry->nouveaux = nouveaux;
+        __entry->dureeNs = dureeNs;
+    ),
+    TP_printk("etat=0x%llx nouveaux=%d duree=%lluns",
+              __entry->etat, __entry->nouveaux, __entry->dureeNs)
+);
+
+// Ajout d'un événement dans le buffer circulaire (perdu = 1 si le buffer était plein)
+TRACE_EVENT(setr_enfilage,
+    TP_PROTO(const struct setr_evenement *ev, unsigned int position, int perdu),
+    TP_ARGS(ev, position, perdu),
+    TP_STRUCT__entry(
+        __field(u32, sequence)
+        __field(unsigned int, position)
+        __field(char, code)
+        __field(u8, type)
+        __field(int, perdu)
+    ),
+    TP_fast_assign(
+        __entry->sequence = ev->sequence;
+        __entry->position = position;
+        __entry->code = ev->code;
+        __entry->type = ev->type;
+        __entry->perdu = perdu;
+    ),
+    TP_printk("seq=%u pos=%u touche=%c %s%s%s", __entry->sequence, __entry->position,
+              __entry->code, SETR_EV_TYPE(__entry->type) == SETR_EV_APPUI ? "appui" : "relache",
+              (__entry->type & SETR_EV_FIN_TRAME) ? " fin" : "",
+              __entry->perdu ? " (perdu)" : "")
+);
+
+// Retrait d'événements par read() : nombre retiré et nouvelle position de lecture
+TRACE_EVENT(setr_defilage,
+    TP_PROTO(unsigned int nombre, unsigned int position),
+    TP_ARGS(nombre, position),
+    TP_STRUCT__entry(
+        __field(unsigned int, nombre)
+        __field(unsigned int, position)
+    ),
+    TP_fast_assign(
+        __entry->nombre = nombre;
+        __entry->position = position;
+    ),
+    TP_printk("nombre=%u pos=%u", __entry->nombre, __entry->position)
+);
+
+#endif
+
+// Ce fichier n'est pas dans include/trace/events : on indique où le retrouver
+// (le Kbuild ajoute -I$(src) aux pilotes)
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE setr_trace
+#include <trace/define_trace.h>
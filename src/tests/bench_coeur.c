@@ -0,0 +1,330 @@
+/******************************************************************************
+* H2023
+* LABORATOIRE 4, Systèmes embarqués et temps réel
+* Mesures du coeur des pilotes (setr_coeur.h), sur le PC
+*
+* Donne le coût du coeur seul, sans GPIO : les broches sont lues dans une table
+* précalculée. Sur le Raspberry Pi, un accès GPIO coûte bien davantage ; ces mesures
+* servent à comparer deux versions du coeur, pas à prédire la latence du pilote.
+* Aucune mesure ne passe par un appel système : les lecteurs retirent les événements
+* de l'anneau en mémoire (copie et synchronisation seulement). Ces chiffres ne comparent
+* donc pas read() et mmap ; pour cela, mesurer le vrai pilote avec les options -m et -l
+* de gpiosim/injecteur.
+*   make bench    (depuis src/ ou src/tests/)
+*/
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "matrice_sim.h"
+#include "../setr_lecteur.h"
+
+static const char codes[SETR_MAX_TOUCHES + 1] =
+    "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz#*";
+
+static volatile __u64 puits;    // Empêche le compilateur d'éliminer les boucles mesurées
+
+static unsigned long long maintenant(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Broches instantanées : la lecture des colonnes de chaque ligne vient d'une table
+struct brochesTable {
+    unsigned long colonnes[8];
+    unsigned long ligne;
+};
+
+static void tableEcrireLignes(void *contexte, unsigned long masque){
+    ((struct brochesTable *)contexte)->ligne = masque;
+}
+
+static unsigned long tableLireColonnes(void *contexte){
+    struct brochesTable *b = contexte;
+
+    return b->colonnes[__builtin_ctzl(b->ligne | 0x100)];
+}
+
+static void initTable(struct brochesTable *b, struct setr_matrice *m, int nbLignes, int nbColonnes, __u64 etat){
+    int l;
+
+    memset(b, 0, sizeof(*b));
+    for (l = 0; l < nbLignes; l++)
+        b->colonnes[l] = (etat >> (l * nbColonnes)) & ((1UL << nbColonnes) - 1);
+    m->ecrireLignes = tableEcrireLignes;
+    m->lireColonnes = tableLireColonnes;
+    m->contexte = b;
+    m->nbLignes = nbLignes;
+    m->nbColonnes = nbColonnes;
+}
+
+
+// ---------------------------------------------------------------------------
+// Balayage
+
+static void mesurerBalayage(int nbLignes, int nbColonnes, int nbEnfoncees){
+    // Balayage seul, puis tour complet du thread d'acquisition (balayage, filtrage,
+    // publication) avec un lecteur qui vide l'anneau
+    enum { TOURS = 2000000 };
+    struct brochesTable broches;
+    struct setr_matrice m;
+    struct setr_antirebond *f = simAntirebond(nbLignes * nbColonnes);
+    struct setr_anneau a;
+    void *zone = simZone(&a, 1024, SETR_DEBORDEMENT_REJETER);
+    unsigned long long debut, balayage, tour;
+    __u64 etat = 0, somme = 0;
+    int i;
+
+    // Touches en diagonale : jamais de rectangle fantôme
+    for (i = 0; i < nbEnfoncees; i++)
+        etat |= SETR_BIT(i * nbColonnes + i);
+    initTable(&broches, &m, nbLignes, nbColonnes, etat);
+
+    debut = maintenant();
+    for (i = 0; i < TOURS; i++)
+        somme += setr_balayer_matrice(&m);
+    balayage = maintenant() - debut;
+
+    // Une fois sur deux les touches sont relâchées : le filtrage et la publication travaillent
+    debut = maintenant();
+    for (i = 0; i < TOURS; i++){
+        if (i % 1000 == 0)
+            initTable(&broches, &m, nbLignes, nbColonnes, (i / 1000) % 2 ? 0 : etat);
+        etat = setr_filtrer_rebonds(f, &m, setr_balayer_matrice(&m), i * 100000ULL, 5000000, 5000000);
+        setr_publier_changements(f, &a, &m, codes, etat, i, 1);
+        setr_anneau_liberer(&a, setr_anneau_fin(&a));
+    }
+    tour = maintenant() - debut;
+    puits = somme;
+
+    printf("  %dx%d, %d touche(s) : balayage %6.1f ns, tour complet %6.1f ns\n",
+           nbLignes, nbColonnes, nbEnfoncees, (double)balayage / TOURS, (double)tour / TOURS);
+    free(f);
+    free(zone);
+}
+
+
+// ---------------------------------------------------------------------------
+// Anneau d'événements
+
+static void publier(struct setr_anneau *a, int n, __u64 horodatage){
+    // Trame de n événements, comme setr_publier_changements (politique rejeter) mais
+    // sans l'anti-rebond : seul le coût de l'anneau est mesuré
+    struct setr_evenement ev = { .horodatageNs = horodatage, .code = 'x' };
+    int i;
+
+    if (setr_anneau_libres(a) < (__u32)n){
+        a->perdus += n;
+        for (i = 0; i < n; i++)
+            setr_anneau_enfiler(a, &ev, 1);
+        return;
+    }
+    setr_anneau_reserver(a, n);     // Sans cela, le lecteur croit ses copies réécrites
+    for (i = 0; i < n; i++){
+        ev.type = SETR_EV_APPUI | (i == n - 1 ? SETR_EV_FIN_TRAME : 0);
+        setr_anneau_enfiler(a, &ev, 0);
+    }
+    setr_anneau_publier(a);
+    a->enfiles += n;
+}
+
+static __u32 consommer(struct setr_anneau *a, struct setr_evenement *dest, __u32 max){
+    // Côté lecteur, comme lireEvenements dans le pilote
+    __u32 fin = setr_anneau_fin(a), lecture = setr_anneau_position_lecture(a, fin);
+    __u32 n = fin - lecture < max ? fin - lecture : max, segment = setr_anneau_segment(a, lecture, n);
+
+    memcpy(dest, setr_anneau_case(a, lecture), segment * sizeof(*dest));
+    memcpy(dest + segment, a->evenements, (n - segment) * sizeof(*dest));
+    if (setr_anneau_premier_valide(a, lecture) != lecture)
+        return 0;
+    setr_anneau_liberer(a, lecture + n);
+    return n;
+}
+
+static void mesurerEnfilage(int parTrame){
+    // Un thread : une trame est publiée puis lue aussitôt
+    enum { EVENEMENTS = 8000000 };
+    struct setr_evenement dest[64];
+    struct setr_anneau a;
+    void *zone = simZone(&a, 256, SETR_DEBORDEMENT_REJETER);
+    unsigned long long debut, duree;
+    __u64 somme = 0;
+    int i;
+
+    debut = maintenant();
+    for (i = 0; i < EVENEMENTS / parTrame; i++){
+        publier(&a, parTrame, i);
+        somme += consommer(&a, dest, 64);
+    }
+    duree = maintenant() - debut;
+    puits = somme;
+    printf("  trames de %d : %5.1f ns par evenement (enfiler + publier + lire)\n", parTrame, (double)duree / EVENEMENTS);
+    free(zone);
+}
+
+struct deuxThreads {
+    struct setr_anneau a;
+    struct setr_lecteur *lecteur;       // Lecture comme un programme ayant projeté l'anneau, ou NULL (copie)
+    int termine;
+    unsigned long long recus;
+    unsigned long long latences;        // Somme, publication -> extraction
+};
+
+static void *lecteurContinu(void *arg){
+    struct deuxThreads *d = arg;
+    struct setr_evenement dest[64];
+    unsigned long long instant;
+    __u32 n, i;
+
+    for (;;){
+        if (d->lecteur)
+            n = setr_lecteur_extraire(d->lecteur, dest, 64);
+        else
+            n = consommer(&d->a, dest, 64);
+        if (n > 0){
+            instant = maintenant();
+            for (i = 0; i < n; i++)
+                d->latences += instant - dest[i].horodatageNs;
+            d->recus += n;
+            continue;
+        }
+        if (__atomic_load_n(&d->termine, __ATOMIC_ACQUIRE) && setr_anneau_disponibles(&d->a) == 0)
+            break;
+        sched_yield();      // Sur un seul processeur, le producteur doit pouvoir avancer
+    }
+    return NULL;
+}
+
+static void mesurerDeuxThreads(__u32 taille, int parMmap){
+    // Producteur et lecteur sur deux threads ; le producteur attend la place. Le lecteur
+    // copie les événements hors de l'anneau comme lireEvenements (sans copy_to_iter ni
+    // appel système), ou passe par setr_lecteur_extraire de setr_lecteur.h.
+    // Chaque événement porte son instant de publication, pour la latence.
+    enum { EVENEMENTS = 1000000 };
+    struct deuxThreads d;
+    struct setr_lecteur lecteur;
+    void *zone;
+    pthread_t thread;
+    unsigned long long debut, duree, attentes = 0;
+    int i;
+
+    memset(&d, 0, sizeof(d));
+    zone = simZone(&d.a, taille, SETR_DEBORDEMENT_REJETER);
+    if (parMmap){
+        memset(&lecteur, 0, sizeof(lecteur));
+        lecteur.fd = -1;
+        lecteur.entete = zone;
+        lecteur.evenements = d.a.evenements;
+        lecteur.masque = taille - 1;
+        d.lecteur = &lecteur;
+    }
+    pthread_create(&thread, NULL, lecteurContinu, &d);
+    debut = maintenant();
+    for (i = 0; i < EVENEMENTS; i++){
+        while (setr_anneau_libres(&d.a) == 0){
+            attentes++;
+            sched_yield();
+        }
+        publier(&d.a, 1, maintenant());
+    }
+    __atomic_store_n(&d.termine, 1, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+    duree = maintenant() - debut;
+    printf("  anneau de %5u, %-12s : %5.1f ns par evenement (%5.1f M/s), latence moyenne %8.1f us,"
+           " %llu recus, %.2f attentes par evenement\n",
+           taille, parMmap ? "setr_lecteur" : "copie", (double)duree / EVENEMENTS, EVENEMENTS * 1e3 / duree,
+           d.recus ? (double)d.latences / d.recus / 1e3 : 0.0, d.recus, (double)attentes / EVENEMENTS);
+    free(zone);
+}
+
+static void mesurerTampons(size_t octets){
+    // Débit de copie selon la taille du lot demandé (le tampon qu'on passerait à read()) :
+    // l'anneau est rempli sans mesure, puis vidé par lots de octets / sizeof(struct
+    // setr_evenement) événements, en deux segments au plus comme lireEvenements. Un reste de moins d'un événement n'est
+    // pas copié (le pilote le rend au lecteur suivant). Le coût de l'appel système, fixe
+    // par read(), s'y ajoute sur le vrai pilote : les petits tampons le paient plus souvent.
+    enum { TAILLE = 4096, REMPLISSAGES = 1000 };
+    struct setr_anneau a;
+    void *zone = simZone(&a, TAILLE, SETR_DEBORDEMENT_REJETER);
+    struct setr_evenement *dest = malloc(TAILLE * sizeof(*dest));
+    __u32 parLecture = octets / sizeof(*dest), n;
+    unsigned long long debut, duree = 0, lus = 0, lectures = 0;
+    int i;
+
+    for (i = 0; i < REMPLISSAGES; i++){
+        while (setr_anneau_libres(&a) > 0)
+            publier(&a, setr_anneau_libres(&a) < 64 ? setr_anneau_libres(&a) : 64, i);
+        debut = maintenant();
+        while ((n = consommer(&a, dest, parLecture)) > 0){
+            lus += n;
+            lectures++;
+        }
+        duree += maintenant() - debut;
+    }
+    puits = dest[0].horodatageNs;
+    printf("  tampon de %6zu octets : %8.1f Mo/s, %6.1f ns par lecture\n",
+           octets, lus * sizeof(*dest) * 1e3 / duree, (double)duree / lectures);
+    free(dest);
+    free(zone);
+}
+
+static void mesurerPlein(int politique, const char *nom){
+    // Personne ne lit : chaque trame est rejetée, ou écrase les plus anciens événements.
+    // Les trames passent par setr_publier_changements, avec le décompte des pertes.
+    enum { TRAMES = 4000000 };
+    struct matriceSim sim;
+    struct setr_antirebond *f = simAntirebond(12);
+    struct setr_anneau a;
+    void *zone = simZone(&a, 256, politique);
+    unsigned long long debut, duree;
+    int i;
+
+    simInit(&sim, 4, 3);
+    debut = maintenant();
+    for (i = 0; i < TRAMES; i++)
+        setr_publier_changements(f, &a, &sim.matrice, codes, f->etatStable ^ 0x3, i, 1);
+    duree = maintenant() - debut;
+    printf("  anneau plein, %-8s : %5.1f ns par trame de 2, %llu enfiles, %llu perdus\n", nom,
+           (double)duree / TRAMES, (unsigned long long)a.enfiles, (unsigned long long)a.perdus);
+    free(f);
+    free(zone);
+}
+
+
+int main(void){
+    static const int geometries[][2] = { {4, 3}, {4, 4}, {8, 8} };
+    unsigned int g;
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    printf("Balayage (broches instantanees)\n");
+    for (g = 0; g < sizeof(geometries) / sizeof(geometries[0]); g++){
+        mesurerBalayage(geometries[g][0], geometries[g][1], 0);
+        mesurerBalayage(geometries[g][0], geometries[g][1], 1);
+        mesurerBalayage(geometries[g][0], geometries[g][1], 3);
+    }
+
+    printf("Anneau, un thread\n");
+    mesurerEnfilage(1);
+    mesurerEnfilage(4);
+
+    printf("Anneau, producteur et lecteur sur deux threads (sans appel systeme : pas une comparaison read/mmap)\n");
+    for (g = 0; g < 3; g++){
+        mesurerDeuxThreads(16 << (4 * g), 0);
+        mesurerDeuxThreads(16 << (4 * g), 1);
+    }
+
+    printf("Copie hors de l'anneau selon la taille du lot (sans appel systeme)\n");
+    for (g = 16; g <= 65536; g *= 4)
+        mesurerTampons(g);
+    mesurerTampons(100);        // Pas un multiple de la taille d'un événement
+
+    printf("Anneau plein\n");
+    mesurerPlein(SETR_DEBORDEMENT_REJETER, "rejeter");
+    mesurerPlein(SETR_DEBORDEMENT_ECRASER, "ecraser");
+    return 0;
+}
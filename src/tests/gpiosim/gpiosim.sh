@@ -0,0 +1,144 @@
+#!/bin/sh
+# H2023
+# LABORATOIRE 4, Systèmes embarqués et temps réel
+# Création d'une puce gpio-sim pour charger le pilote sur un PC, sans Raspberry Pi
+#
+#   sudo ./gpiosim.sh verifier           : vérifie que le noyau permet le banc (fait aussi par creer)
+#   sudo ./gpiosim.sh creer [colonnes [colonnes2]]
+#                                         : crée la puce et affiche les commandes insmod et injecteur ;
+#                                           avec colonnes2, un second clavier sur une seconde banque
+#   sudo ./gpiosim.sh detruire           : retire la puce (décharger le pilote avant)
+#
+# Les lignes d'une puce gpio-sim ne sont pas reliées entre elles : une colonne ne voit
+# pas la ligne qui la pilote, et un programme utilisateur est bien trop lent pour suivre
+# les lignes pendant un balayage. Le clavier simulé n'a donc qu'une ligne (la ligne 0 de
+# la puce) et de 1 à 8 colonnes (lignes 1 et suivantes) : chaque colonne est une touche,
+# enfoncée lorsque l'injecteur met son tirage à pull-up. Les balayages, les IRQ de
+# colonnes, l'anti-rebond, l'anneau et la lecture sont ceux du pilote réel ; les
+# rectangles fantômes, qui demandent plusieurs lignes, sont couverts par les tests du
+# coeur (voir ../Makefile).
+#
+# Avec deux claviers, chaque banque (bank0, bank1) est une puce GPIO à part, câblée comme
+# la première. Le pilote les charge ensemble (lignes=1,1 colonnes=N,M) et crée
+# /dev/claviersetr et /dev/claviersetr1 : deux injecteurs lancés en même temps vérifient
+# que les claviers ne se volent ni événements ni IRQ.
+#
+# Demande un noyau avec modules (CONFIG_MODULES), ses en-têtes pour compiler le pilote,
+# CONFIG_GPIO_SIM (Linux 5.17 et plus) et configfs. Un conteneur ou une machine virtuelle
+# minimale n'a souvent rien de cela : verifier dit ce qui manque.
+
+set -e
+
+NOM=setr
+CONFIGFS=/sys/kernel/config
+PUCE=$CONFIGFS/gpio-sim/$NOM
+
+baseGlobale(){
+    # Numéro global de la première ligne de la puce $1 (gpiochipN), pour gpio_request
+    for d in /sys/class/gpio/gpiochip*; do
+        if [ "$(basename "$(readlink -f "$d/device")")" = "$1" ]; then
+            cat "$d/base"
+            return
+        fi
+    done
+    # Sans CONFIG_GPIO_SYSFS : "gpiochipN: GPIOs 512-520, parent: platform/gpio-sim.0, ..."
+    sed -n "s/^$1: GPIOs \([0-9]*\)-.*/\1/p" /sys/kernel/debug/gpio
+}
+
+verifier(){
+    # Chaque condition manquante est signalée ; retourne 1 s'il en manque au moins une
+    manque=0
+    if [ ! -e /proc/modules ]; then
+        echo "Noyau $(uname -r) sans modules chargeables (CONFIG_MODULES) : ni le pilote ni gpio-sim ne peuvent etre charges" >&2
+        manque=1
+    elif ! command -v modprobe >/dev/null 2>&1; then
+        echo "modprobe introuvable (paquet kmod)" >&2
+        manque=1
+    elif [ ! -d /sys/module/gpio_sim ] && ! modprobe -n gpio-sim 2>/dev/null; then
+        echo "Module gpio-sim introuvable pour $(uname -r) (CONFIG_GPIO_SIM)" >&2
+        manque=1
+    fi
+    if [ ! -d /lib/modules/"$(uname -r)"/build ]; then
+        echo "En-tetes du noyau absents (/lib/modules/$(uname -r)/build) : le pilote ne peut etre compile" >&2
+        manque=1
+    fi
+    if ! grep -qw configfs /proc/filesystems; then
+        echo "configfs absent de /proc/filesystems (CONFIG_CONFIGFS_FS)" >&2
+        manque=1
+    fi
+    return $manque
+}
+
+verifierColonnes(){
+    if [ "$1" -lt 1 ] || [ "$1" -gt 8 ]; then
+        echo "Le pilote accepte de 1 a 8 colonnes" >&2
+        exit 1
+    fi
+}
+
+declarerBanque(){
+    # Banque $1 : la ligne 0 pilote la ligne du clavier, les $2 suivantes sont ses colonnes
+    mkdir $PUCE/bank$1
+    echo $(($2 + 1)) > $PUCE/bank$1/num_lines
+    echo "$NOM-clavier$1" > $PUCE/bank$1/label
+}
+
+preparerBanque(){
+    # Tire les colonnes de la banque $1 à 0 (repos) et fixe ecrire, lire et chemin
+    puce=$(cat $PUCE/bank$1/chip_name)
+    base=$(baseGlobale "$puce")
+    chemin=/sys/devices/platform/$dev/$puce
+    for i in $(seq 1 "$2"); do
+        echo pull-down > $chemin/sim_gpio$i/pull
+    done
+    ecrire=$base
+    lire=$((base + 1))
+    for i in $(seq 2 "$2"); do
+        lire="$lire,$((base + i))"
+    done
+    echo "Puce $puce ($dev), GPIO $base a $((base + $2))"
+}
+
+creer(){
+    colonnes=${1:-8}
+    colonnes2=$2
+    verifierColonnes "$colonnes"
+    [ -z "$colonnes2" ] || verifierColonnes "$colonnes2"
+    verifier || exit 1
+    modprobe gpio-sim
+    mountpoint -q $CONFIGFS || mount -t configfs none $CONFIGFS
+    mkdir $PUCE
+    declarerBanque 0 "$colonnes"
+    [ -z "$colonnes2" ] || declarerBanque 1 "$colonnes2"
+    echo 1 > $PUCE/live
+
+    dev=$(cat $PUCE/dev_name)
+    preparerBanque 0 "$colonnes"
+    touches=$(echo 12345678 | cut -c1-"$colonnes")
+    if [ -z "$colonnes2" ]; then
+        echo "  insmod setr_driver.ko gpiosEcrire=$ecrire gpiosLire=$lire touches=$touches"
+        echo "  ./injecteur -p $chemin -c $colonnes"
+        return
+    fi
+
+    ecrire0=$ecrire lire0=$lire chemin0=$chemin
+    preparerBanque 1 "$colonnes2"
+    echo "  insmod setr_driver.ko gpiosEcrire=$ecrire0,$ecrire gpiosLire=$lire0,$lire" \
+         "lignes=1,1 colonnes=$colonnes,$colonnes2 touches=$touches,$(echo abcdefgh | cut -c1-"$colonnes2")"
+    echo "  ./injecteur -p $chemin0 -c $colonnes -d /dev/claviersetr > clavier0.txt &"
+    echo "  ./injecteur -p $chemin -c $colonnes2 -d /dev/claviersetr1 > clavier1.txt; wait"
+}
+
+detruire(){
+    echo 0 > $PUCE/live
+    [ ! -d $PUCE/bank1 ] || rmdir $PUCE/bank1
+    rmdir $PUCE/bank0
+    rmdir $PUCE
+}
+
+case "$1" in
+    verifier) verifier && echo "Le noyau $(uname -r) permet le banc gpio-sim" ;;
+    creer) creer "$2" "$3" ;;
+    detruire) detruire ;;
+    *) echo "usage : $0 verifier | creer [colonnes [colonnes2]] | detruire" >&2; exit 1 ;;
+esac
@@ -0,0 +1,496 @@
+/******************************************************************************
+* H2023
+* LABORATOIRE 4, Systèmes embarqués et temps réel
+* Injecteur de touches pour un clavier gpio-sim (voir gpiosim.sh)
+*
+* Appuie sur les touches simulées à un rythme donné, en changeant le tirage des
+* colonnes de la puce gpio-sim, pendant qu'un second thread lit /dev/claviersetr en
+* mode événements. À la fin, affiche le débit, les événements perdus (trous de
+* séquence, appuis jamais reçus), les doublons et la latence appui→lecture.
+* Avec -m, les événements sont retirés de l'anneau projeté par mmap (setr_lecteur.h)
+* plutôt que par read() : les deux chemins se comparent avec les mêmes appuis.
+* Avec -i, les touches sont lues sur un périphérique evdev (/dev/input/eventN) : celui du
+* pilote chargé avec sortieInput=1, ou celui du relais uinput (relais_uinput.c), qui
+* reproduit un programme relisant /dev/claviersetr pour réinjecter les touches. Les deux
+* latences se comparent alors avec les mêmes appuis. evdev n'a pas de numéro de séquence :
+* un SYN_DROPPED compte pour un trou.
+* La charge est aussi relevée avant et après l'injection : temps CPU du thread
+* d'acquisition (/proc/<pid>/stat), temps passé en interruptions sur toute la machine
+* (/proc/stat) et compteurs du pilote (/sys/class/setr/<clavier>/). Avec -b, les
+* rebonds arrivent à 20 kHz : -c 8 -r 80 -t 6000 -b 20 produit environ 6,5 kHz de
+* fronts en moyenne, et montre ce que coûtent la fenêtre de regroupement et maxBalayagesIrq.
+*
+*   ./injecteur -p /sys/devices/platform/gpio-sim.0/gpiochip1 -c 8 [options]
+*     -d fichier   périphérique à lire (/dev/claviersetr)
+*     -n nombre    nombre d'appuis à injecter (1000)
+*     -r appuis/s  rythme des appuis (50)
+*     -t us        durée de chaque appui (10000)
+*     -a touches   touches enfoncées ensemble à chaque appui, en accord (1)
+*     -b rebonds   fronts parasites avant chaque appui et chaque relâchement (0)
+*     -m           lire par mmap (setr_lecteur_extraire) plutôt que par read()
+*     -l octets    taille de chaque lecture (64 événements), pas forcément un multiple
+*                  d'un événement : le pilote ne copie que des événements entiers
+*     -i fichier   lire les touches sur ce périphérique evdev ; -d ne sert plus qu'à
+*                  nommer le clavier pour les compteurs et le thread d'acquisition
+*
+* La durée d'un appui doit dépasser debounceAppuiUs, et l'intervalle entre deux
+* appuis la durée de l'appui plus debounceRelacheUs, sans quoi le pilote a raison
+* de ne pas voir certains appuis.
+*/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <libgen.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../../setr_clavier.h"
+#include "../../setr_lecteur.h"
+
+#define MAX_COLONNES 8
+#define ECART_REBOND_NS 50000   // Intervalle entre deux fronts parasites
+
+static const char *cheminPuce;
+static const char *cheminClavier = "/dev/claviersetr";
+static const char *cheminInput;         // Avec -i seulement
+static int nbColonnes = 0, nbAppuis = 1000, rythme = 50, accord = 1, rebonds = 0;
+static long dureeAppuiUs = 10000;
+static int parMmap = 0;
+static size_t tailleLecture = 64 * sizeof(struct setr_evenement);
+static struct setr_lecteur anneau;      // Avec -m seulement
+
+// Appuis injectés, dans l'ordre : l'injecteur publie nbInjectes (release) après
+// avoir rempli la case, le lecteur ne regarde que les cases publiées
+static unsigned long long *instantAppui;
+static unsigned char *colonneAppui;
+static int nbInjectes;
+static int termine;
+
+// Résultats du lecteur
+static unsigned long long *latences;    // Appui → read(), par appui reçu
+static int nbLatences, nbRelachements, nbDoublons, nbTrous, nbEvenements, nbLectures;
+static unsigned int perdusSequence;
+static unsigned long long debutLecture, finLecture;
+
+// Charge du pilote, relevée avant et après l'injection (voir lireCharge)
+static const char *const nomsCompteurs[] = {
+    "frontsRecus", "frontsFusionnes", "frontsMasques", "balayages", "balayagesIrq", "limitationsDebit",
+};
+#define NB_COMPTEURS (sizeof(nomsCompteurs) / sizeof(nomsCompteurs[0]))
+struct charge {
+    long long tempsThread;              // utime + stime du thread d'acquisition, en tics (-1 : introuvable)
+    long long tempsIrq;                 // irq + softirq de tous les processeurs, en tics
+    long long compteurs[NB_COMPTEURS];  // -1 : attribut absent
+};
+
+static unsigned long long maintenant(void){
+    // Même horloge que les horodatages du pilote (ktime_get_ns)
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void dormirJusqua(unsigned long long instant){
+    struct timespec ts = { .tv_sec = instant / 1000000000ULL, .tv_nsec = instant % 1000000000ULL };
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+static void tirer(int colonne, int haut){
+    // La colonne c est la ligne c + 1 de la puce (la ligne 0 est la ligne du clavier)
+    char chemin[256];
+    const char *valeur = haut ? "pull-up" : "pull-down";
+    int fd;
+
+    snprintf(chemin, sizeof(chemin), "%s/sim_gpio%d/pull", cheminPuce, colonne + 1);
+    fd = open(chemin, O_WRONLY);
+    if (fd < 0 || write(fd, valeur, strlen(valeur)) < 0){
+        perror(chemin);
+        exit(1);
+    }
+    close(fd);
+}
+
+static void tirerAccord(int premiere, int haut){
+    int i;
+
+    for (i = 0; i < accord; i++)
+        tirer((premiere + i) % nbColonnes, haut);
+}
+
+static void rebondir(int premiere, int haut){
+    // Fronts parasites, qui laissent la colonne dans son état précédent
+    int i;
+
+    for (i = 0; i < rebonds; i++){
+        tirerAccord(premiere, haut);
+        dormirJusqua(maintenant() + ECART_REBOND_NS);
+        tirerAccord(premiere, !haut);
+        dormirJusqua(maintenant() + ECART_REBOND_NS);
+    }
+}
+
+static int couvre(int appui, int colonne){
+    // L'appui enfonce-t-il cette colonne ? (accord de touches consécutives)
+    return (colonne - colonneAppui[appui] + nbColonnes) % nbColonnes < accord;
+}
+
+static int convertirInput(const struct input_event *ie, int n, struct setr_evenement *ev){
+    // Traduit les événements evdev en événements du pilote : MSC_SCAN donne le numéro de la
+    // touche (la colonne, le clavier simulé n'ayant qu'une ligne), l'EV_KEY qui le suit
+    // l'appui (1) ou le relâchement (0). Les répétitions (2) sont ignorées.
+    static unsigned int sequence;
+    static int touche = -1;
+    int i, nb = 0;
+
+    for (i = 0; i < n; i++){
+        if (ie[i].type == EV_MSC && ie[i].code == MSC_SCAN)
+            touche = ie[i].value;
+        else if (ie[i].type == EV_SYN && ie[i].code == SYN_DROPPED)
+            sequence++;
+        else if (ie[i].type == EV_KEY && ie[i].value != 2 && touche >= 0){
+            memset(&ev[nb], 0, sizeof(ev[nb]));
+            ev[nb].sequence = ++sequence;
+            ev[nb].colonne = touche;
+            ev[nb].type = ie[i].value ? SETR_EV_APPUI : SETR_EV_RELACHE;
+            nb++;
+            touche = -1;
+        }
+    }
+    return nb;
+}
+
+static int lireLot(int fd, struct setr_evenement *ev){
+    // Retourne le nombre d'événements lus (0 s'il n'y en avait pas), -1 après 50 ms sans
+    // événement. poll() plutôt qu'une attente active : le réveil fait partie de la latence.
+    // ev peut recevoir tailleLecture octets.
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    ssize_t lus;
+
+    if (parMmap){
+        if (setr_lecteur_attendre(&anneau, 50) == 0)
+            return -1;
+        nbLectures++;
+        return setr_lecteur_extraire(&anneau, ev, tailleLecture / sizeof(*ev));
+    }
+    if (poll(&pfd, 1, 50) == 0)
+        return -1;
+    nbLectures++;
+    if (cheminInput){
+        // Au moins trois événements evdev par touche : ev a toujours la place
+        struct input_event ie[64];
+        size_t max = tailleLecture / sizeof(*ev) < 64 ? tailleLecture / sizeof(*ev) : 64;
+
+        lus = read(fd, ie, max * sizeof(ie[0]));
+        if (lus > 0)
+            return convertirInput(ie, lus / sizeof(ie[0]), ev);
+    }
+    else
+        lus = read(fd, ev, tailleLecture);
+    if (lus < 0 && errno == EAGAIN)
+        return 0;
+    if (lus < 0){
+        perror("read");
+        exit(1);
+    }
+    return lus / sizeof(*ev);
+}
+
+static void *lecteur(void *arg){
+    // Lit les événements jusqu'à la fin de l'injection, puis tant qu'il en arrive
+    int fd = *(int *)arg;
+    struct setr_evenement *ev = malloc(tailleLecture + sizeof(*ev));
+    int prochainAppui[MAX_COLONNES] = {0};  // Premier appui pas encore reçu, par colonne
+    int enfoncee[MAX_COLONNES] = {0};
+    int sequenceConnue = 0, i, n, injectes, c;
+    unsigned int sequence = 0;
+    unsigned long long instant;
+
+    if (!ev)
+        exit(1);
+    debutLecture = maintenant();
+    for (;;){
+        n = lireLot(fd, ev);
+        instant = maintenant();
+        if (n < 0){
+            if (__atomic_load_n(&termine, __ATOMIC_ACQUIRE))
+                break;
+            continue;
+        }
+        injectes = __atomic_load_n(&nbInjectes, __ATOMIC_ACQUIRE);
+        for (i = 0; i < n; i++){
+            nbEvenements++;
+            finLecture = instant;
+            // Séquence : un trou indique des pertes, un recul un doublon
+            if (sequenceConnue && ev[i].sequence != sequence + 1){
+                if ((int)(ev[i].sequence - sequence) <= 0)
+                    nbDoublons++;
+                else {
+                    nbTrous++;
+                    perdusSequence += ev[i].sequence - sequence - 1;
+                }
+            }
+            sequenceConnue = 1;
+            sequence = ev[i].sequence;
+
+            c = ev[i].colonne;
+            if (c >= nbColonnes)
+                continue;
+            if (SETR_EV_TYPE(ev[i].type) == SETR_EV_RELACHE){
+                enfoncee[c] = 0;
+                nbRelachements++;
+                continue;
+            }
+            // Un appui sur une touche déjà enfoncée est un doublon
+            if (enfoncee[c]){
+                nbDoublons++;
+                continue;
+            }
+            enfoncee[c] = 1;
+            // On l'associe au plus ancien appui injecté sur cette colonne et pas encore reçu
+            while (prochainAppui[c] < injectes && !couvre(prochainAppui[c], c))
+                prochainAppui[c]++;
+            if (prochainAppui[c] >= injectes){
+                nbDoublons++;
+                continue;
+            }
+            latences[nbLatences++] = instant - instantAppui[prochainAppui[c]];
+            prochainAppui[c]++;
+        }
+    }
+    free(ev);
+    return NULL;
+}
+
+static long long lireEntier(const char *chemin){
+    FILE *f = fopen(chemin, "r");
+    long long valeur = -1;
+
+    if (f){
+        if (fscanf(f, "%lld", &valeur) != 1)
+            valeur = -1;
+        fclose(f);
+    }
+    return valeur;
+}
+
+static long long tempsThreadAcquisition(const char *nom){
+    // Le thread du clavier /dev/claviersetrN s'appelle Thread_clavierN (N = 0 pour le premier) ;
+    // il n'existe que tant qu'un fichier est ouvert sur le clavier
+    char chemin[300], comm[64], attendu[64];
+    unsigned long long utime, stime;
+    struct dirent *e;
+    DIR *proc = opendir("/proc");
+    long long temps = -1;
+    FILE *f;
+
+    snprintf(attendu, sizeof(attendu), "Thread_clavier%d\n",
+             strncmp(nom, "claviersetr", 11) == 0 ? atoi(nom + 11) : 0);
+    while (proc && temps < 0 && (e = readdir(proc)) != NULL){
+        snprintf(chemin, sizeof(chemin), "/proc/%s/comm", e->d_name);
+        f = fopen(chemin, "r");
+        if (!f)
+            continue;
+        if (fgets(comm, sizeof(comm), f) && strcmp(comm, attendu) == 0){
+            fclose(f);
+            snprintf(chemin, sizeof(chemin), "/proc/%s/stat", e->d_name);
+            f = fopen(chemin, "r");
+            // Champs 14 et 15, après "pid (comm) état" ; comm ne contient pas d'espace
+            if (f && fscanf(f, "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+                            &utime, &stime) == 2)
+                temps = utime + stime;
+        }
+        if (f)
+            fclose(f);
+    }
+    if (proc)
+        closedir(proc);
+    return temps;
+}
+
+static void lireCharge(struct charge *c){
+    char chemin[256], copie[256], *nom;
+    unsigned long long irq = 0, softirq = 0;
+    unsigned int i;
+    FILE *f;
+
+    snprintf(copie, sizeof(copie), "%s", cheminClavier);
+    nom = basename(copie);
+    c->tempsThread = tempsThreadAcquisition(nom);
+    c->tempsIrq = 0;
+    f = fopen("/proc/stat", "r");
+    if (f){
+        if (fscanf(f, "cpu %*u %*u %*u %*u %*u %llu %llu", &irq, &softirq) == 2)
+            c->tempsIrq = irq + softirq;
+        fclose(f);
+    }
+    for (i = 0; i < NB_COMPTEURS; i++){
+        snprintf(chemin, sizeof(chemin), "/sys/class/setr/%s/%s", nom, nomsCompteurs[i]);
+        c->compteurs[i] = lireEntier(chemin);
+    }
+}
+
+static void afficherCharge(const struct charge *avant, const struct charge *apres, unsigned long long duree){
+    // Le coût d'un front doit rester borné : les fronts injectés croissent avec -b, les
+    // interruptions prises (frontsRecus) et les balayages beaucoup moins
+    double secondes = duree / 1e9, tic = 1e3 / sysconf(_SC_CLK_TCK);
+    unsigned long long fronts = 2ULL * nbAppuis * accord * (2 * rebonds + 1);
+    unsigned int i;
+
+    printf("Fronts injectes      : %llu (%.0f/s en moyenne)\n", fronts, fronts / secondes);
+    if (avant->tempsThread >= 0 && apres->tempsThread >= 0)
+        printf("CPU du thread        : %.0f ms (%.2f %% d'un processeur)\n",
+               (apres->tempsThread - avant->tempsThread) * tic,
+               (apres->tempsThread - avant->tempsThread) * tic / 10 / secondes);
+    else
+        printf("CPU du thread        : thread d'acquisition introuvable\n");
+    printf("CPU en interruptions : %.0f ms, toute la machine (irq + softirq)\n",
+           (apres->tempsIrq - avant->tempsIrq) * tic);
+    for (i = 0; i < NB_COMPTEURS; i++)
+        if (avant->compteurs[i] >= 0 && apres->compteurs[i] >= 0)
+            printf("  %-18s : %lld (%.0f/s)\n", nomsCompteurs[i], apres->compteurs[i] - avant->compteurs[i],
+                   (apres->compteurs[i] - avant->compteurs[i]) / secondes);
+}
+
+static int comparer(const void *a, const void *b){
+    unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void afficherResultats(unsigned long long duree){
+    int attendus = nbAppuis * accord;
+    double secondes = (finLecture > debutLecture ? finLecture - debutLecture : 1) / 1e9;
+
+    printf("Appuis injectes      : %d (%d touche(s) chacun) en %.2f s, lus par %s\n", nbAppuis, accord,
+           duree / 1e9, cheminInput ? "evdev" : parMmap ? "mmap" : "read()");
+    printf("Evenements lus       : %d (%.0f/s), %d appuis, %d relachements\n",
+           nbEvenements, nbEvenements / secondes, nbLatences, nbRelachements);
+    printf("Lectures             : %d de %zu octets au plus, %.0f octets/s, %.1f evenements par lecture\n",
+           nbLectures, tailleLecture, nbEvenements * sizeof(struct setr_evenement) / secondes,
+           nbLectures ? (double)nbEvenements / nbLectures : 0.0);
+    printf("Appuis perdus        : %d\n", attendus > nbLatences ? attendus - nbLatences : 0);
+    printf("Trous de sequence    : %d (%u evenements)\n", nbTrous, perdusSequence);
+    printf("Doublons             : %d\n", nbDoublons);
+    if (nbLatences > 0){
+        qsort(latences, nbLatences, sizeof(latences[0]), comparer);
+        printf("Latence appui->read  : min %.1f us, mediane %.1f us, 99e centile %.1f us, max %.1f us\n",
+               latences[0] / 1e3, latences[nbLatences / 2] / 1e3,
+               latences[(nbLatences * 99) / 100] / 1e3, latences[nbLatences - 1] / 1e3);
+    }
+}
+
+int main(int argc, char **argv){
+    struct setr_config config = { .champs = SETR_CFG_MODE_SORTIE, .modeSortie = SETR_MODE_EVENEMENTS };
+    unsigned long long debut, appui, intervalle;
+    struct charge avant, apres;
+    pthread_t thread;
+    int fd, opt, i, premiere;
+
+    while ((opt = getopt(argc, argv, "p:c:d:n:r:t:a:b:ml:i:")) != -1){
+        switch (opt){
+        case 'p': cheminPuce = optarg; break;
+        case 'c': nbColonnes = atoi(optarg); break;
+        case 'd': cheminClavier = optarg; break;
+        case 'n': nbAppuis = atoi(optarg); break;
+        case 'r': rythme = atoi(optarg); break;
+        case 't': dureeAppuiUs = atol(optarg); break;
+        case 'a': accord = atoi(optarg); break;
+        case 'b': rebonds = atoi(optarg); break;
+        case 'm': parMmap = 1; break;
+        case 'l': tailleLecture = strtoul(optarg, NULL, 0); break;
+        case 'i': cheminInput = optarg; break;
+        default:
+            fprintf(stderr, "usage : %s -p puce -c colonnes [-d fichier] [-n appuis] [-r appuis/s]"
+                            " [-t us] [-a touches] [-b rebonds] [-m] [-l octets] [-i evdev]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (!cheminPuce || nbColonnes < 1 || nbColonnes > MAX_COLONNES || nbAppuis < 1 || rythme < 1
+        || accord < 1 || accord > nbColonnes || rebonds < 0 || tailleLecture < sizeof(struct setr_evenement)
+        || (cheminInput && parMmap)){
+        fprintf(stderr, "Parametres invalides (voir l'en-tete de injecteur.c)\n");
+        return 1;
+    }
+    intervalle = 1000000000ULL / rythme;
+    if ((unsigned long long)dureeAppuiUs * 1000 >= intervalle){
+        fprintf(stderr, "La duree d'un appui doit etre plus courte que l'intervalle entre deux appuis\n");
+        return 1;
+    }
+
+    instantAppui = calloc(nbAppuis, sizeof(*instantAppui));
+    colonneAppui = calloc(nbAppuis, sizeof(*colonneAppui));
+    latences = calloc((size_t)nbAppuis * accord, sizeof(*latences));
+    if (!instantAppui || !colonneAppui || !latences)
+        return 1;
+
+    if (cheminInput){
+        // Le fichier spécial n'est pas ouvert : personne ne viderait son anneau. L'ouverture
+        // du périphérique evdev du pilote, ou celle du relais, démarre l'acquisition.
+        fd = open(cheminInput, O_RDONLY | O_NONBLOCK);
+        if (fd < 0){
+            perror(cheminInput);
+            return 1;
+        }
+    }
+    else {
+        // O_RDWR : SETR_IOC_CONFIGURER demande un fichier ouvert en écriture. Le mode de
+        // sortie est commun aux lecteurs du clavier : il reste en mode événements après la mesure.
+        fd = open(cheminClavier, O_RDWR | O_NONBLOCK);
+        if (fd < 0){
+            perror(cheminClavier);
+            return 1;
+        }
+        if (ioctl(fd, SETR_IOC_CONFIGURER, &config) < 0){
+            perror("SETR_IOC_CONFIGURER");
+            return 1;
+        }
+        ioctl(fd, SETR_IOC_VIDER);
+    }
+    // Un seul consommateur par anneau : avec -m, fd ne sert plus qu'aux ioctl
+    if (parMmap && (errno = -setr_lecteur_ouvrir(&anneau, cheminClavier)) != 0){
+        perror("mmap");
+        return 1;
+    }
+    if (pthread_create(&thread, NULL, lecteur, &fd) != 0)
+        return 1;
+
+    lireCharge(&avant);
+    debut = maintenant() + 10000000ULL;
+    for (i = 0; i < nbAppuis; i++){
+        premiere = i % nbColonnes;
+        appui = debut + i * intervalle;
+        dormirJusqua(appui);
+        rebondir(premiere, 1);
+        instantAppui[i] = maintenant();
+        colonneAppui[i] = premiere;
+        __atomic_store_n(&nbInjectes, i + 1, __ATOMIC_RELEASE);
+        tirerAccord(premiere, 1);
+
+        dormirJusqua(instantAppui[i] + dureeAppuiUs * 1000ULL);
+        rebondir(premiere, 0);
+        tirerAccord(premiere, 0);
+    }
+    // On laisse au pilote le temps de filtrer le dernier relâchement
+    dormirJusqua(maintenant() + intervalle + 100000000ULL);
+    __atomic_store_n(&termine, 1, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+    lireCharge(&apres);
+
+    afficherResultats(maintenant() - debut);
+    afficherCharge(&avant, &apres, maintenant() - debut);
+    if (parMmap)
+        setr_lecteur_fermer(&anneau);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,132 @@
+/******************************************************************************
+* H2023
+* LABORATOIRE 4, Systèmes embarqués et temps réel
+* Relais uinput : l'ancien chemin vers evdev, pour comparer avec sortieInput=1
+*
+* Lit /dev/claviersetr en mode événements et réinjecte chaque touche par uinput, comme
+* le programme utilisateur qu'on employait avant que le pilote ne rapporte lui-même ses
+* touches au sous-système input : un processus, une copie et un changement de contexte
+* de plus par trame. Chaque touche est envoyée comme le fait le pilote (MSC_SCAN avec
+* son numéro, puis EV_KEY avec le code de setr_code_input), et chaque trame se termine
+* par un seul EV_SYN.
+*
+*   sudo ./relais_uinput [-d /dev/claviersetr] [-c colonnes] &
+*   sudo ./injecteur -p <puce> -c 8 -i /dev/input/eventN     (N affiché par le relais)
+*
+* Le pilote est chargé sans sortieInput, pour que seul le relais alimente evdev. Le
+* relais garde le fichier spécial ouvert : l'acquisition tourne tant qu'il vit.
+* -c donne le nombre de colonnes du clavier (8), pour numéroter les touches comme le
+* pilote (ligne * colonnes + colonne).
+*/
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <linux/uinput.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "../../setr_clavier.h"
+
+static void emettre(int fd, unsigned short type, unsigned short code, int valeur){
+    struct input_event ie;
+
+    memset(&ie, 0, sizeof(ie));
+    ie.type = type;
+    ie.code = code;
+    ie.value = valeur;
+    if (write(fd, &ie, sizeof(ie)) != sizeof(ie)){
+        perror("uinput");
+        exit(1);
+    }
+}
+
+static int creerUinput(void){
+    static const char valeurs[] = "0123456789abcdefghijklmnopqrstuvwxyz*#";
+    struct uinput_setup config;
+    char nom[64], chemin[128];
+    struct dirent *e;
+    DIR *d;
+    int fd, i;
+
+    fd = open("/dev/uinput", O_WRONLY);
+    if (fd < 0){
+        perror("/dev/uinput");
+        exit(1);
+    }
+    ioctl(fd, UI_SET_EVBIT, EV_KEY);
+    ioctl(fd, UI_SET_EVBIT, EV_MSC);
+    ioctl(fd, UI_SET_MSCBIT, MSC_SCAN);
+    ioctl(fd, UI_SET_KEYBIT, KEY_UNKNOWN);
+    for (i = 0; valeurs[i] != '\0'; i++)
+        ioctl(fd, UI_SET_KEYBIT, setr_code_input(valeurs[i]));
+
+    memset(&config, 0, sizeof(config));
+    config.id.bustype = BUS_VIRTUAL;
+    snprintf(config.name, sizeof(config.name), "setr-relais-uinput");
+    if (ioctl(fd, UI_DEV_SETUP, &config) < 0 || ioctl(fd, UI_DEV_CREATE) < 0){
+        perror("UI_DEV_CREATE");
+        exit(1);
+    }
+
+    // Le périphérique evdev créé est le seul eventN de /sys/class/input/inputM
+    if (ioctl(fd, UI_GET_SYSNAME(sizeof(nom)), nom) >= 0){
+        snprintf(chemin, sizeof(chemin), "/sys/class/input/%s", nom);
+        d = opendir(chemin);
+        while (d && (e = readdir(d)) != NULL)
+            if (strncmp(e->d_name, "event", 5) == 0)
+                printf("Relais pret : /dev/input/%s\n", e->d_name);
+        if (d)
+            closedir(d);
+    }
+    fflush(stdout);
+    return fd;
+}
+
+int main(int argc, char **argv){
+    struct setr_config reglage = { .champs = SETR_CFG_MODE_SORTIE, .modeSortie = SETR_MODE_EVENEMENTS };
+    const char *cheminClavier = "/dev/claviersetr";
+    struct setr_evenement ev[64];
+    int fd, sortie, opt, colonnes = 8, i;
+    ssize_t lus;
+
+    while ((opt = getopt(argc, argv, "d:c:")) != -1){
+        switch (opt){
+        case 'd': cheminClavier = optarg; break;
+        case 'c': colonnes = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage : %s [-d fichier] [-c colonnes]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    fd = open(cheminClavier, O_RDWR);
+    if (fd < 0){
+        perror(cheminClavier);
+        return 1;
+    }
+    if (ioctl(fd, SETR_IOC_CONFIGURER, &reglage) < 0){
+        perror("SETR_IOC_CONFIGURER");
+        return 1;
+    }
+    ioctl(fd, SETR_IOC_VIDER);
+    sortie = creerUinput();
+
+    // read() bloquant : le relais dort jusqu'à la prochaine trame, comme l'ancien
+    for (;;){
+        lus = read(fd, ev, sizeof(ev));
+        if (lus < 0){
+            perror("read");
+            return 1;
+        }
+        for (i = 0; i < lus / (ssize_t)sizeof(ev[0]); i++){
+            emettre(sortie, EV_MSC, MSC_SCAN, ev[i].ligne * colonnes + ev[i].colonne);
+            emettre(sortie, EV_KEY, setr_code_input(ev[i].code), SETR_EV_TYPE(ev[i].type) == SETR_EV_APPUI);
+            if (ev[i].type & SETR_EV_FIN_TRAME)
+                emettre(sortie, EV_SYN, SYN_REPORT, 0);
+        }
+    }
+}
@@ -0,0 +1,86 @@
+/******************************************************************************
+* H2023
+* LABORATOIRE 4, Systèmes embarqués et temps réel
+* Clavier simulé pour les tests et les mesures du coeur (setr_coeur.h)
+*
+* La matrice n'a pas de diodes, comme celle du laboratoire : une ligne pilotée à 1
+* atteint toutes les colonnes reliées à elle par des touches enfoncées, y compris en
+* passant par d'autres lignes et colonnes. Trois touches aux coins d'un rectangle font
+* donc lire la quatrième, exactement comme sur le vrai clavier.
+*/
+#ifndef MATRICE_SIM_H
+#define MATRICE_SIM_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../setr_coeur.h"
+
+struct matriceSim {
+    struct setr_matrice matrice;
+    __u64 enfoncees;            // Touches réellement enfoncées (bit ligne * nbColonnes + colonne)
+    unsigned long lignes;       // Lignes pilotées à 1
+    unsigned long nbEcritures;
+    unsigned long nbLectures;
+};
+
+static inline unsigned long colonnesDeLigne(const struct matriceSim *s, int ligne){
+    return (s->enfoncees >> (ligne * s->matrice.nbColonnes)) & ((1UL << s->matrice.nbColonnes) - 1);
+}
+
+static inline void simEcrireLignes(void *contexte, unsigned long masque){
+    struct matriceSim *s = contexte;
+
+    s->lignes = masque;
+    s->nbEcritures++;
+}
+
+static inline unsigned long simLireColonnes(void *contexte){
+    // Parcourt les chemins électriques à partir des lignes pilotées, jusqu'à ce que
+    // plus aucune ligne ni colonne ne s'ajoute
+    struct matriceSim *s = contexte;
+    unsigned long lignes = s->lignes, colonnes = 0, lignesAvant, colonnesAvant;
+    int ligne;
+
+    s->nbLectures++;
+    do {
+        lignesAvant = lignes;
+        colonnesAvant = colonnes;
+        for (ligne = 0; ligne < s->matrice.nbLignes; ligne++){
+            if (lignes & (1UL << ligne))
+                colonnes |= colonnesDeLigne(s, ligne);
+            else if (colonnesDeLigne(s, ligne) & colonnes)
+                lignes |= 1UL << ligne;
+        }
+    } while (lignes != lignesAvant || colonnes != colonnesAvant);
+    return colonnes;
+}
+
+static inline void simInit(struct matriceSim *s, int nbLignes, int nbColonnes){
+    memset(s, 0, sizeof(*s));
+    s->matrice.ecrireLignes = simEcrireLignes;
+    s->matrice.lireColonnes = simLireColonnes;
+    s->matrice.contexte = s;
+    s->matrice.nbLignes = nbLignes;
+    s->matrice.nbColonnes = nbColonnes;
+}
+
+static inline __u64 simTouche(const struct matriceSim *s, int ligne, int colonne){
+    return SETR_BIT(ligne * s->matrice.nbColonnes + colonne);
+}
+
+static inline struct setr_antirebond *simAntirebond(int nbTouches){
+    return calloc(1, SETR_TAILLE_ANTIREBOND(nbTouches));
+}
+
+// Anneau dans une zone ordinaire, disposée comme celle projetée par mmap
+#define SIM_DECALAGE 4096
+
+static inline void *simZone(struct setr_anneau *a, __u32 taille, int politique){
+    void *zone = calloc(1, SIM_DECALAGE + (size_t)taille * sizeof(struct setr_evenement));
+
+    setr_anneau_init(a, zone, taille, SIM_DECALAGE, politique);
+    return zone;
+}
+
+#endif
@@ -0,0 +1,620 @@
+/******************************************************************************
+* H2023
+* LABORATOIRE 4, Systèmes embarqués et temps réel
+* Tests unitaires du coeur des pilotes (setr_coeur.h), sur le PC
+*
+* Le coeur ne dépend ni des GPIO ni de l'horloge du noyau : on le fait tourner sur
+* un clavier simulé (matrice_sim.h) avec des instants choisis par le test.
+*   make test    (depuis src/ ou src/tests/)
+*/
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+
+#include "matrice_sim.h"
+#include "../setr_lecteur.h"
+
+#define US 1000ULL
+#define MS 1000000ULL
+#define DEBOUNCE (5 * MS)
+
+static const char codes[SETR_MAX_TOUCHES + 1] =
+    "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz#*";
+
+static int nbVerifications, nbEchecs;
+
+#define VERIFIER(condition, ...) do {                                           \
+        nbVerifications++;                                                      \
+        if (!(condition)){                                                      \
+            nbEchecs++;                                                         \
+            printf("  ECHEC %s:%d : %s : ", __FILE__, __LINE__, #condition);    \
+            printf(__VA_ARGS__);                                                \
+            printf("\n");                                                       \
+        }                                                                       \
+    } while (0)
+
+// Un clavier complet : matrice simulée, anti-rebond et anneau, comme dans le pilote
+struct banc {
+    struct matriceSim sim;
+    struct setr_antirebond *f;
+    struct setr_anneau anneau;
+    void *zone;
+    struct setr_lecteur lecteur;
+};
+
+static void bancInit(struct banc *b, int nbLignes, int nbColonnes, __u32 taille, int politique){
+    simInit(&b->sim, nbLignes, nbColonnes);
+    b->f = simAntirebond(nbLignes * nbColonnes);
+    b->zone = simZone(&b->anneau, taille, politique);
+    // Lecteur sans appel système, sur la même zone que le ferait mmap
+    memset(&b->lecteur, 0, sizeof(b->lecteur));
+    b->lecteur.fd = -1;
+    b->lecteur.entete = b->zone;
+    b->lecteur.evenements = b->anneau.evenements;
+    b->lecteur.masque = taille - 1;
+}
+
+static void bancLiberer(struct banc *b){
+    free(b->f);
+    free(b->zone);
+}
+
+static int bancBalayer(struct banc *b, __u64 maintenant){
+    // Un tour du thread d'acquisition : balayage, filtrage, publication
+    __u64 etat = setr_balayer_matrice(&b->sim.matrice);
+
+    etat = setr_filtrer_rebonds(b->f, &b->sim.matrice, etat, maintenant, DEBOUNCE, DEBOUNCE);
+    return setr_publier_changements(b->f, &b->anneau, &b->sim.matrice, codes, etat, maintenant, 1);
+}
+
+static unsigned int bancLire(struct banc *b, struct setr_evenement *ev, unsigned int max){
+    return setr_lecteur_extraire(&b->lecteur, ev, max);
+}
+
+
+// ---------------------------------------------------------------------------
+// Balayage
+
+static void testBalayage(void){
+    static const int geometries[][2] = { {4, 3}, {4, 4}, {8, 8}, {1, 8} };
+    struct matriceSim sim;
+    unsigned int g;
+    int l, c;
+
+    for (g = 0; g < sizeof(geometries) / sizeof(geometries[0]); g++){
+        simInit(&sim, geometries[g][0], geometries[g][1]);
+        VERIFIER(setr_balayer_matrice(&sim.matrice) == 0, "%dx%d au repos", geometries[g][0], geometries[g][1]);
+        for (l = 0; l < sim.matrice.nbLignes; l++){
+            for (c = 0; c < sim.matrice.nbColonnes; c++){
+                sim.enfoncees = simTouche(&sim, l, c);
+                sim.nbEcritures = 0;
+                VERIFIER(setr_balayer_matrice(&sim.matrice) == sim.enfoncees, "touche (%d, %d)", l, c);
+                VERIFIER(sim.nbEcritures == (unsigned long)sim.matrice.nbLignes, "une écriture par ligne");
+            }
+        }
+    }
+}
+
+static void testBalayageDepuisRepos(void){
+    // Après un réveil par interruption, lignes à 1 : toute combinaison de touches est lue
+    // comme par le balayage complet, et une seule touche coûte moins d'accès à partir de
+    // 4 lignes (1 + 2 par bit du numéro de ligne + 2 pour la vérification)
+    static const int geometries[][2] = { {4, 3}, {4, 4}, {8, 8}, {1, 8}, {2, 3}, {3, 3}, {5, 2} };
+    struct matriceSim sim;
+    unsigned long acces, attendus;
+    unsigned int g;
+    int l, c, autre, n, bits;
+    __u64 lu;
+
+    for (g = 0; g < sizeof(geometries) / sizeof(geometries[0]); g++){
+        simInit(&sim, geometries[g][0], geometries[g][1]);
+        n = sim.matrice.nbLignes;
+        for (bits = 0; (1 << bits) < n; bits++)
+            ;
+        for (c = 0; c < sim.matrice.nbColonnes; c++){
+            // Chaque sous-ensemble des touches de la colonne
+            for (l = 1; l < (1 << n); l++){
+                sim.enfoncees = 0;
+                for (autre = 0; autre < n; autre++)
+                    if (l & (1 << autre))
+                        sim.enfoncees |= simTouche(&sim, autre, c);
+                simEcrireLignes(&sim, setr_masque_lignes(&sim.matrice));
+                sim.nbEcritures = sim.nbLectures = 0;
+                lu = setr_balayer_depuis_repos(&sim.matrice);
+                acces = sim.nbEcritures + sim.nbLectures;
+                VERIFIER(lu == sim.enfoncees, "%dx%d colonne %d lignes %#x : lu %#llx", n,
+                         sim.matrice.nbColonnes, c, l, (unsigned long long)lu);
+                if ((l & (l - 1)) != 0)
+                    continue;
+                attendus = n == 1 ? 1 : (n < 4 ? 2UL * n : 3UL + 2 * bits);
+                VERIFIER(acces == attendus, "%dx%d touche (%d, %d) : %lu acces, %lu attendus", n,
+                         sim.matrice.nbColonnes, __builtin_ctz(l), c, acces, attendus);
+            }
+        }
+
+        // Deux colonnes actives : balayage complet, rectangles fantômes compris
+        for (c = 0; c + 1 < sim.matrice.nbColonnes && n > 1; c++){
+            sim.enfoncees = simTouche(&sim, 0, c) | simTouche(&sim, 0, c + 1) | simTouche(&sim, 1, c);
+            simEcrireLignes(&sim, setr_masque_lignes(&sim.matrice));
+            VERIFIER(setr_balayer_depuis_repos(&sim.matrice) == setr_balayer_matrice(&sim.matrice),
+                     "%dx%d colonnes %d et %d", n, sim.matrice.nbColonnes, c, c + 1);
+        }
+
+        // Front parasite, rien d'enfoncé : une seule lecture (dès 4 lignes, ou pour une seule)
+        sim.enfoncees = 0;
+        simEcrireLignes(&sim, setr_masque_lignes(&sim.matrice));
+        sim.nbEcritures = sim.nbLectures = 0;
+        VERIFIER(setr_balayer_depuis_repos(&sim.matrice) == 0, "%dx%d au repos", n, sim.matrice.nbColonnes);
+        VERIFIER(n == 2 || n == 3 || (sim.nbLectures == 1 && sim.nbEcritures == 0),
+                 "%dx%d au repos : %lu acces", n, sim.matrice.nbColonnes, sim.nbLectures + sim.nbEcritures);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Rectangles fantômes et accords
+
+static void testDeuxTouchesSansFantome(void){
+    // Deux touches quelconques sont toujours lues exactement, sans fantôme
+    struct matriceSim sim;
+    int a, b;
+
+    simInit(&sim, 4, 3);
+    for (a = 0; a < 12; a++){
+        for (b = a + 1; b < 12; b++){
+            sim.enfoncees = SETR_BIT(a) | SETR_BIT(b);
+            VERIFIER(setr_balayer_matrice(&sim.matrice) == sim.enfoncees, "touches %d et %d", a, b);
+            VERIFIER(setr_touches_fantomes(&sim.matrice, sim.enfoncees) == 0, "touches %d et %d", a, b);
+        }
+    }
+}
+
+static void testRectangleFantome(void){
+    // Trois coins enfoncés font lire le quatrième : les quatre sont signalés
+    struct matriceSim sim;
+    __u64 rectangle, lu;
+
+    simInit(&sim, 4, 3);
+    sim.enfoncees = simTouche(&sim, 0, 0) | simTouche(&sim, 0, 2) | simTouche(&sim, 3, 0);
+    rectangle = sim.enfoncees | simTouche(&sim, 3, 2);
+    lu = setr_balayer_matrice(&sim.matrice);
+    VERIFIER(lu == rectangle, "lu %#llx", (unsigned long long)lu);
+    VERIFIER(setr_touches_fantomes(&sim.matrice, lu) == rectangle, "fantomes");
+
+    // Trois touches sur une même ligne, ou en diagonale, ne forment pas de rectangle
+    sim.enfoncees = simTouche(&sim, 1, 0) | simTouche(&sim, 1, 1) | simTouche(&sim, 1, 2);
+    VERIFIER(setr_touches_fantomes(&sim.matrice, setr_balayer_matrice(&sim.matrice)) == 0, "ligne");
+    sim.enfoncees = simTouche(&sim, 0, 0) | simTouche(&sim, 1, 1) | simTouche(&sim, 2, 2);
+    VERIFIER(setr_touches_fantomes(&sim.matrice, setr_balayer_matrice(&sim.matrice)) == 0, "diagonale");
+}
+
+static void testRectangleDepuisRepos(void){
+    // Trois coins enfoncés ensemble : rien n'est publié tant que le rectangle tient, puis
+    // les deux touches restantes sortent en une seule trame lorsqu'un coin est relâché
+    struct banc b;
+    struct setr_evenement ev[16];
+    __u64 t = 0;
+    unsigned int n;
+
+    bancInit(&b, 4, 3, 64, SETR_DEBORDEMENT_REJETER);
+    b.sim.enfoncees = simTouche(&b.sim, 0, 0) | simTouche(&b.sim, 0, 2) | simTouche(&b.sim, 3, 0);
+    for (; t < 50 * MS; t += MS)
+        bancBalayer(&b, t);
+    VERIFIER(bancLire(&b, ev, 16) == 0, "rectangle publié");
+
+    b.sim.enfoncees &= ~simTouche(&b.sim, 0, 0);
+    for (; t < 100 * MS; t += MS)
+        bancBalayer(&b, t);
+    n = bancLire(&b, ev, 16);
+    VERIFIER(n == 2, "n = %u", n);
+    if (n == 2){
+        VERIFIER(ev[0].ligne == 0 && ev[0].colonne == 2 && ev[1].ligne == 3 && ev[1].colonne == 0, "ordre des touches");
+        VERIFIER(ev[0].type == SETR_EV_APPUI && ev[1].type == (SETR_EV_APPUI | SETR_EV_FIN_TRAME), "types");
+        VERIFIER(ev[0].horodatageNs == ev[1].horodatageNs, "même horodatage");
+    }
+    bancLiberer(&b);
+}
+
+static void testRectangleApresDeuxTouches(void){
+    // Deux touches déjà publiées restent enfoncées ; la troisième, qui ferme le
+    // rectangle, est figée, et la touche fantôme n'est jamais publiée
+    struct banc b;
+    struct setr_evenement ev[16];
+    __u64 t = 0, deux;
+    unsigned int n, i;
+
+    bancInit(&b, 4, 3, 64, SETR_DEBORDEMENT_REJETER);
+    deux = simTouche(&b.sim, 1, 0) | simTouche(&b.sim, 1, 1);
+    b.sim.enfoncees = deux;
+    for (; t < 20 * MS; t += MS)
+        bancBalayer(&b, t);
+    VERIFIER(bancLire(&b, ev, 16) == 2, "deux appuis");
+
+    b.sim.enfoncees |= simTouche(&b.sim, 2, 1);
+    for (; t < 60 * MS; t += MS)
+        bancBalayer(&b, t);
+    n = bancLire(&b, ev, 16);
+    VERIFIER(n == 0, "%u événements pendant le rectangle", n);
+    VERIFIER(b.f->etatStable == deux, "état stable %#llx", (unsigned long long)b.f->etatStable);
+
+    // Le rectangle se défait : la troisième touche sort, la fantôme jamais
+    b.sim.enfoncees &= ~simTouche(&b.sim, 1, 0);
+    for (; t < 100 * MS; t += MS)
+        bancBalayer(&b, t);
+    n = bancLire(&b, ev, 16);
+    VERIFIER(n == 2, "n = %u", n);
+    for (i = 0; i < n; i++)
+        VERIFIER(!(ev[i].ligne == 2 && ev[i].colonne == 0), "touche fantôme publiée");
+    bancLiberer(&b);
+}
+
+static void testAccord(void){
+    // Trois touches enfoncées dans le même balayage forment une seule trame
+    struct banc b;
+    struct setr_evenement ev[16];
+    __u64 t;
+    unsigned int n, i;
+
+    bancInit(&b, 4, 3, 64, SETR_DEBORDEMENT_REJETER);
+    b.sim.enfoncees = simTouche(&b.sim, 0, 0) | simTouche(&b.sim, 1, 1) | simTouche(&b.sim, 2, 2);
+    for (t = 0; t < 20 * MS; t += MS)
+        bancBalayer(&b, t);
+    n = bancLire(&b, ev, 16);
+    VERIFIER(n == 3, "n = %u", n);
+    for (i = 0; i < n; i++){
+        VERIFIER(ev[i].ligne == i && ev[i].colonne == i, "ordre %u", i);
+        VERIFIER(ev[i].horodatageNs == ev[0].horodatageNs, "horodatage %u", i);
+        VERIFIER(ev[i].type == (SETR_EV_APPUI | (i == n - 1 ? SETR_EV_FIN_TRAME : 0)), "type %u", i);
+        VERIFIER(ev[i].sequence == i, "séquence %u", i);
+    }
+    bancLiberer(&b);
+}
+
+
+// ---------------------------------------------------------------------------
+// Anti-rebond
+
+struct front {
+    __u64 instant;
+    int niveau;
+};
+
+static void formeOnde(const struct front *fronts, int nbFronts, __u64 periode, __u64 duree,
+                      int *appuis, int *relachements, __u64 *premierAppui){
+    // Balaye une touche qui suit la forme d'onde donnée et compte les événements publiés
+    struct banc b;
+    struct setr_evenement ev[64];
+    unsigned int n, i;
+    int f = 0;
+    __u64 t;
+
+    bancInit(&b, 4, 3, 256, SETR_DEBORDEMENT_REJETER);
+    *appuis = *relachements = 0;
+    *premierAppui = 0;
+    for (t = 0; t < duree; t += periode){
+        while (f < nbFronts && fronts[f].instant <= t)
+            b.sim.enfoncees = fronts[f++].niveau ? simTouche(&b.sim, 1, 1) : 0;
+        bancBalayer(&b, t);
+        n = bancLire(&b, ev, 64);
+        for (i = 0; i < n; i++){
+            if (SETR_EV_TYPE(ev[i].type) == SETR_EV_APPUI){
+                if ((*appuis)++ == 0)
+                    *premierAppui = ev[i].horodatageNs;
+            }
+            else
+                (*relachements)++;
+        }
+    }
+    bancLiberer(&b);
+}
+
+static void testRebonds(void){
+    // Un appui et un relâchement qui rebondissent chacun pendant quelques ms
+    static const struct front rebonds[] = {
+        {10 * MS, 1}, {10 * MS + 300 * US, 0}, {10 * MS + 700 * US, 1}, {11 * MS, 0},
+        {11 * MS + 200 * US, 1}, {12 * MS + 500 * US, 0}, {12 * MS + 600 * US, 1},
+        {60 * MS, 0}, {60 * MS + 400 * US, 1}, {61 * MS, 0}, {62 * MS, 1}, {62 * MS + 100 * US, 0},
+    };
+    // Une impulsion plus courte que le délai anti-rebond
+    static const struct front impulsion[] = { {10 * MS, 1}, {12 * MS, 0} };
+    static const __u64 periodes[] = { 100 * US, 500 * US, MS };
+    int appuis, relachements;
+    unsigned int p;
+    __u64 premier;
+
+    for (p = 0; p < sizeof(periodes) / sizeof(periodes[0]); p++){
+        formeOnde(rebonds, sizeof(rebonds) / sizeof(rebonds[0]), periodes[p], 120 * MS, &appuis, &relachements, &premier);
+        VERIFIER(appuis == 1 && relachements == 1, "période %llu ns : %d appuis, %d relâchements",
+                 (unsigned long long)periodes[p], appuis, relachements);
+        // L'appui n'est accepté qu'une fois le contact stable pendant tout le délai. Le
+        // dernier rebond, de 100 us, n'est vu qu'avec la période la plus courte.
+        VERIFIER(premier >= (periodes[p] <= 100 * US ? 12 * MS + 600 * US : 12 * MS) + DEBOUNCE,
+                 "appui accepté à %llu ns", (unsigned long long)premier);
+
+        formeOnde(impulsion, 2, periodes[p], 50 * MS, &appuis, &relachements, &premier);
+        VERIFIER(appuis == 0 && relachements == 0, "impulsion : %d appuis", appuis);
+    }
+}
+
+static void testRebondsAleatoires(void){
+    // 200 appuis avec des rafales de rebonds aléatoires : exactement un appui et un
+    // relâchement chacun, en alternance
+    enum { NB_APPUIS = 200, MAX_FRONTS = NB_APPUIS * 2 * 12 };
+    static struct front fronts[MAX_FRONTS];
+    int appuis, relachements, nb = 0, i, k, niveau;
+    __u64 t = 10 * MS, premier;
+
+    srand(42);
+    for (i = 0; i < NB_APPUIS; i++){
+        for (niveau = 1; niveau >= 0; niveau--){
+            // Rafale de 0 à 10 fronts espacés de 50 à 800 us, puis niveau stable 10 à 30 ms
+            for (k = rand() % 11; k > 0; k--){
+                fronts[nb++] = (struct front){ t, k % 2 ? niveau : !niveau };
+                t += (50 + rand() % 750) * US;
+            }
+            fronts[nb++] = (struct front){ t, niveau };
+            t += (10 + rand() % 20) * MS;
+        }
+    }
+    formeOnde(fronts, nb, 500 * US, t + 20 * MS, &appuis, &relachements, &premier);
+    VERIFIER(appuis == NB_APPUIS && relachements == NB_APPUIS, "%d appuis, %d relâchements", appuis, relachements);
+}
+
+
+// ---------------------------------------------------------------------------
+// Débordement de l'anneau
+
+static void publierTrame(struct banc *b, __u64 horodatage, int nbTouches){
+    // Publie une trame de nbTouches événements : les touches 0..nbTouches-1 changent d'état
+    __u64 etat = b->f->etatStable ^ (SETR_BIT(nbTouches) - 1);
+
+    setr_publier_changements(b->f, &b->anneau, &b->sim.matrice, codes, etat, horodatage, 1);
+}
+
+static void testDebordementRejeter(void){
+    // Anneau de 16 : cinq trames de 3 tiennent, la sixième est perdue en entier
+    struct banc b;
+    struct setr_evenement ev[32];
+    unsigned int n, i;
+
+    bancInit(&b, 4, 4, 16, SETR_DEBORDEMENT_REJETER);
+    for (i = 0; i < 6; i++)
+        publierTrame(&b, i, 3);
+    VERIFIER(b.anneau.enfiles == 15 && b.anneau.perdus == 3, "enfilés %llu, perdus %llu",
+             (unsigned long long)b.anneau.enfiles, (unsigned long long)b.anneau.perdus);
+    VERIFIER(b.anneau.occupationMax == 15, "occupation max %u", b.anneau.occupationMax);
+    n = bancLire(&b, ev, 32);
+    VERIFIER(n == 15, "n = %u", n);
+    for (i = 0; i < n; i++)
+        VERIFIER(ev[i].sequence == i && ev[i].horodatageNs == i / 3, "événement %u", i);
+
+    // La trame perdue laisse un trou de séquence visible
+    publierTrame(&b, 6, 3);
+    n = bancLire(&b, ev, 32);
+    VERIFIER(n == 3 && ev[0].sequence == 18, "n = %u, séquence %u", n, n ? ev[0].sequence : 0);
+
+    // Une trame plus grande que l'anneau est toujours perdue
+    bancLiberer(&b);
+    bancInit(&b, 4, 8, 16, SETR_DEBORDEMENT_REJETER);
+    publierTrame(&b, 0, 17);
+    VERIFIER(b.anneau.enfiles == 0 && b.anneau.perdus == 17, "trame trop grande");
+    bancLiberer(&b);
+}
+
+static void testDebordementEcraser(void){
+    // Sans lecture, l'anneau garde les 16 derniers événements
+    struct banc b;
+    struct setr_evenement ev[32];
+    unsigned int n, i;
+
+    bancInit(&b, 4, 4, 16, SETR_DEBORDEMENT_ECRASER);
+    for (i = 0; i < 10; i++)
+        publierTrame(&b, i, 3);
+    VERIFIER(b.anneau.enfiles == 30 && b.anneau.perdus == 14, "enfilés %llu, perdus %llu",
+             (unsigned long long)b.anneau.enfiles, (unsigned long long)b.anneau.perdus);
+    n = bancLire(&b, ev, 32);
+    VERIFIER(n == 16, "n = %u", n);
+    for (i = 0; i < n; i++)
+        VERIFIER(ev[i].sequence == 14 + i, "séquence %u", ev[i].sequence);
+
+    // Une trame plus grande que l'anneau ne peut pas non plus l'écraser
+    bancLiberer(&b);
+    bancInit(&b, 4, 8, 16, SETR_DEBORDEMENT_ECRASER);
+    publierTrame(&b, 0, 17);
+    VERIFIER(b.anneau.enfiles == 0 && b.anneau.perdus == 17, "trame trop grande");
+    bancLiberer(&b);
+}
+
+static void testPositionLectureInvalide(void){
+    // La position de lecture est écrite par l'utilisateur : une valeur absurde compte
+    // comme un anneau plein, et la lecture est ramenée dans l'intervalle valide
+    struct banc b;
+
+    bancInit(&b, 4, 4, 16, SETR_DEBORDEMENT_REJETER);
+    publierTrame(&b, 0, 2);
+    b.anneau.entete->lecture = 12345;
+    VERIFIER(setr_anneau_libres(&b.anneau) == 0, "libres %u", setr_anneau_libres(&b.anneau));
+    VERIFIER(setr_anneau_disponibles(&b.anneau) <= 16, "disponibles %u", setr_anneau_disponibles(&b.anneau));
+    publierTrame(&b, 1, 2);
+    VERIFIER(b.anneau.enfiles == 2 && b.anneau.perdus == 2, "trame rejetée");
+    bancLiberer(&b);
+}
+
+
+// ---------------------------------------------------------------------------
+// Anneau sous charge, producteur et consommateur sur deux threads
+
+#define NB_STRESS 2000000
+#define TAILLE_STRESS 64
+
+struct stress {
+    struct banc b;
+    int bloquer;                // Le producteur attend la place (aucune perte permise)
+    int termine;
+    unsigned long long produits;
+    // Résultats du consommateur
+    unsigned long long recus, doublons, trous, tramesCoupees, desordres;
+};
+
+static void *producteur(void *arg){
+    // Trames de 1 à 4 événements, horodatées par leur numéro
+    struct stress *s = arg;
+    __u64 etat, trame = 0;
+    unsigned int n;
+
+    srand(7);
+    while (s->produits < NB_STRESS){
+        etat = s->b.f->etatStable ^ ((__u64)(1 + rand() % 15) << (4 * (rand() % 4)));
+        n = setr_nb_changements(s->b.f, etat, 1);
+        if (s->bloquer){
+            while (setr_anneau_libres(&s->b.anneau) < n)
+                sched_yield();
+        }
+        setr_publier_changements(s->b.f, &s->b.anneau, &s->b.sim.matrice, codes, etat, trame++, 1);
+        s->produits += n;
+    }
+    __atomic_store_n(&s->termine, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void verifierLot(struct stress *s, const struct setr_evenement *ev, unsigned int n, long long *attendue){
+    unsigned int i;
+
+    for (i = 0; i < n; i++){
+        if (*attendue >= 0 && ev[i].sequence != (__u32)*attendue){
+            if ((int)(ev[i].sequence - (__u32)*attendue) < 0)
+                s->doublons++;
+            else
+                s->trous++;
+        }
+        // Une trame ne change d'horodatage qu'après son dernier événement
+        if (i > 0 && ev[i].horodatageNs != ev[i - 1].horodatageNs && !(ev[i - 1].type & SETR_EV_FIN_TRAME))
+            s->desordres++;
+        *attendue = ev[i].sequence + 1;
+        s->recus++;
+    }
+}
+
+static void *consommateurPilote(void *arg){
+    // Même suite d'appels que lireEvenements dans le pilote (read)
+    struct stress *s = arg;
+    struct setr_anneau *a = &s->b.anneau;
+    struct setr_evenement ev[TAILLE_STRESS];
+    __u32 fin, lecture, premier;
+    unsigned int n, segment;
+    long long attendue = -1;
+    int termine;
+
+    for (;;){
+        termine = __atomic_load_n(&s->termine, __ATOMIC_ACQUIRE);
+        fin = setr_anneau_fin(a);
+        lecture = setr_anneau_position_lecture(a, fin);
+        n = fin - lecture;
+        if (n == 0){
+            if (termine)
+                break;
+            sched_yield();
+            continue;
+        }
+        segment = setr_anneau_segment(a, lecture, n);
+        memcpy(ev, setr_anneau_case(a, lecture), segment * sizeof(ev[0]));
+        memcpy(ev + segment, a->evenements, (n - segment) * sizeof(ev[0]));
+        premier = setr_anneau_premier_valide(a, lecture);
+        if (premier != lecture){
+            setr_anneau_liberer(a, premier);
+            continue;
+        }
+        // Une lecture s'arrête toujours à une fin de trame
+        if (!(ev[n - 1].type & SETR_EV_FIN_TRAME))
+            s->tramesCoupees++;
+        verifierLot(s, ev, n, &attendue);
+        setr_anneau_liberer(a, lecture + n);
+    }
+    return NULL;
+}
+
+static void *consommateurLecteur(void *arg){
+    // Même suite d'appels qu'un programme utilisant mmap (setr_lecteur.h), par petits lots
+    struct stress *s = arg;
+    struct setr_evenement ev[5];
+    long long attendue = -1;
+    unsigned int n;
+    int termine;
+
+    for (;;){
+        termine = __atomic_load_n(&s->termine, __ATOMIC_ACQUIRE);
+        n = setr_lecteur_extraire(&s->b.lecteur, ev, 5);
+        if (n == 0){
+            if (termine)
+                break;
+            sched_yield();
+            continue;
+        }
+        verifierLot(s, ev, n, &attendue);
+    }
+    return NULL;
+}
+
+static void stress(int politique, int bloquer, void *(*consommateur)(void *), const char *nom){
+    struct stress s;
+    pthread_t p, c;
+
+    memset(&s, 0, sizeof(s));
+    bancInit(&s.b, 4, 4, TAILLE_STRESS, politique);
+    s.bloquer = bloquer;
+    pthread_create(&c, NULL, consommateur, &s);
+    pthread_create(&p, NULL, producteur, &s);
+    pthread_join(p, NULL);
+    pthread_join(c, NULL);
+
+    printf("  %s : %llu produits, %llu reçus, %llu perdus\n", nom, s.produits, s.recus,
+           (unsigned long long)s.b.anneau.perdus);
+    VERIFIER(s.doublons == 0 && s.desordres == 0, "%s : %llu doublons, %llu désordres", nom, s.doublons, s.desordres);
+    if (bloquer){
+        VERIFIER(s.recus == s.produits && s.trous == 0 && s.b.anneau.perdus == 0, "%s : pertes", nom);
+        VERIFIER(s.tramesCoupees == 0, "%s : %llu trames coupées", nom, s.tramesCoupees);
+    }
+    else {
+        // Chaque perte est comptée par le producteur : rien ne disparaît sans trace
+        VERIFIER(s.recus <= s.produits && s.recus + s.b.anneau.perdus >= s.produits, "%s : pertes non comptées", nom);
+    }
+    bancLiberer(&s.b);
+}
+
+static void testStress(void){
+    stress(SETR_DEBORDEMENT_REJETER, 1, consommateurPilote, "rejeter, read");
+    stress(SETR_DEBORDEMENT_REJETER, 1, consommateurLecteur, "rejeter, mmap");
+    stress(SETR_DEBORDEMENT_ECRASER, 0, consommateurPilote, "ecraser, read");
+    stress(SETR_DEBORDEMENT_ECRASER, 0, consommateurLecteur, "ecraser, mmap");
+}
+
+
+int main(void){
+    static const struct { void (*test)(void); const char *nom; } tests[] = {
+        { testBalayage, "balayage" },
+        { testBalayageDepuisRepos, "balayage depuis le repos" },
+        { testDeuxTouchesSansFantome, "deux touches sans fantome" },
+        { testRectangleFantome, "rectangle fantome" },
+        { testRectangleDepuisRepos, "rectangle depuis le repos" },
+        { testRectangleApresDeuxTouches, "rectangle apres deux touches" },
+        { testAccord, "accord" },
+        { testRebonds, "rebonds" },
+        { testRebondsAleatoires, "rebonds aleatoires" },
+        { testDebordementRejeter, "debordement, rejeter" },
+        { testDebordementEcraser, "debordement, ecraser" },
+        { testPositionLectureInvalide, "position de lecture invalide" },
+        { testStress, "anneau sous charge" },
+    };
+    unsigned int i;
+    int echecs;
+
+    for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++){
+        echecs = nbEchecs;
+        printf("%s\n", tests[i].nom);
+        tests[i].test();
+        if (nbEchecs != echecs)
+            printf("  -> %d echec(s)\n", nbEchecs - echecs);
+    }
+    printf("%d verifications, %d echec(s)\n", nbVerifications, nbEchecs);
+    return nbEchecs != 0;
+}